@@ -0,0 +1,32 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec3 fragColor;
+in vec3 worldPosition;
+
+// Overdraw view: every fragment adds this color instead, (0, 0, 0) otherwise
+uniform vec3 Overdraw;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    if (Overdraw != vec3(0.0))
+    {
+        color = Overdraw;
+        return;
+    }
+
+    // Sides keep their flat color. A merged top spans many tiles, so the per tile gradient
+    // (vertex color at the front left and back right corners, white at the other two) is
+    // rebuilt from the position inside the tile.
+    vec3 normal = cross(dFdx(worldPosition), dFdy(worldPosition));
+    if (abs(normal.y) > 0.99 * length(normal))
+    {
+        float u = fract(worldPosition.x), v = fract(-worldPosition.z);
+        color = mix(vec3(1.0), fragColor, abs(1.0 - (u + v)));
+    }
+    else
+        color = fragColor;
+}
@@ -0,0 +1,20 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;   // already in world space
+layout (location = 1) in vec3 vertexColor;
+
+uniform mat4 VP;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+out vec3 worldPosition;
+
+void main ()
+{
+    fragColor = vertexColor;
+    worldPosition = vertexPosition;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * vec4(vertexPosition, 1);
+}
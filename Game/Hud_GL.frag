@@ -0,0 +1,16 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 texel;
+in vec4 fragColor;
+
+uniform sampler2D Atlas;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    // The atlas holds one coverage bit per font pixel - blended over the scene
+    color = vec4(fragColor.rgb, fragColor.a * texelFetch(Atlas, ivec2(texel), 0).r);
+}
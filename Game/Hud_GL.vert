@@ -0,0 +1,20 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec2 vertexPosition;   // in pixels, from the top left corner
+layout (location = 1) in vec2 vertexTexel;      // in the glyph atlas
+layout (location = 2) in vec4 vertexColor;
+
+uniform vec2 ScreenSize;
+
+// output data : used by fragment shader
+out vec2 texel;
+out vec4 fragColor;
+
+void main ()
+{
+    texel = vertexTexel;
+    fragColor = vertexColor;
+
+    gl_Position = vec4(vertexPosition.x / ScreenSize.x * 2.0 - 1.0, 1.0 - vertexPosition.y / ScreenSize.y * 2.0, 0, 1);
+}
@@ -0,0 +1,50 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+layout (location = 2) in vec3 vertexAltColor;
+layout (location = 3) in vec4 instanceData;    // xyz : tile offset, w : state bits
+
+uniform mat4 VP;
+
+uniform ivec2 BoardMin;                 // first tile (x, z)
+uniform int BoardWidth;                 // tiles per row
+uniform int BoardDepth;                 // rows
+uniform float LayoutTime;               // seconds since the layout changed
+uniform float TransitionLength;         // seconds a single tile takes to rise or sink
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // 1 and 2 : alternate colors (tiles carrying an obstacle) in the new and old layout,
+    // 4 and 8 : the instance is there in the new and old layout
+    int state = int(instanceData.w);
+    bool present = (state & 4) != 0, wasPresent = (state & 8) != 0;
+
+    // After a layout change, tiles and spikes that come or go rise into place or sink away, in a
+    // wave running from the first tile to the last - the same wave as Pulled_GL.vert
+    ivec2 tile = ivec2(instanceData.xz);
+    float wave = float((tile.x - BoardMin.x) + (tile.y - BoardMin.y)) / float(BoardWidth + BoardDepth);
+    float t = smoothstep(0.0, 1.0, LayoutTime / TransitionLength - wave);
+    float shown = present ? (wasPresent ? 1.0 : t) : (wasPresent ? 1.0 - t : 0.0);
+
+    // Collapse the corners of a missing tile or obstacle onto one point outside the view
+    if (shown <= 0.0)
+    {
+        fragColor = vec3(0.0);
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    // Sunk far enough, a tile is out of sight below the board and spikes (at y 1) are inside their tile
+    float sunk = (instanceData.y > 0.5 ? 2.5 : 3.0) * (1.0 - shown);
+    vec3 color = (state & 1) != 0 ? vertexAltColor : vertexColor;
+    vec3 oldColor = (state & 2) != 0 ? vertexAltColor : vertexColor;
+    fragColor = mix(oldColor, color, t);
+
+    // Output position of the vertex, in clip space : VP * translated position
+    gl_Position = VP * vec4(vertexPosition + instanceData.xyz - vec3(0.0, sunk, 0.0), 1);
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+// The particle update runs with GL_RASTERIZER_DISCARD, so this never executes; it only completes
+// the program without reading inputs the update vertex shader does not write
+
+// output data
+out vec3 color;
+
+void main()
+{
+    color = vec3(0.0);
+}
@@ -0,0 +1,59 @@
+#version 330 core
+
+// input data : the particle as the last frame left it
+layout (location = 0) in vec4 particlePosition;     // xyz, w: age in seconds
+layout (location = 1) in vec4 particleVelocity;     // xyz, w: lifetime in seconds, 0 once dead
+layout (location = 2) in vec4 particleColor;
+
+#define MAX_BURSTS 4
+uniform int Bursts;                     // bursts started this frame
+uniform vec3 BurstOrigin[MAX_BURSTS];
+uniform vec3 BurstColor[MAX_BURSTS];
+uniform int BurstFirst[MAX_BURSTS];     // first particle of each burst - the particles form a ring
+uniform int BurstSize;
+uniform int NumParticles;
+uniform float DeltaTime;
+uniform uint Seed;                      // changes every frame
+
+// output data : captured by transform feedback into the other particle buffer
+out vec4 position;
+out vec4 velocity;
+out vec4 color;
+
+// Integer hash to [0, 1]
+float random (uint n)
+{
+    n = (n << 13U) ^ n;
+    n = n * (n * n * 15731U + 789221U) + 1376312589U;
+    return float(n & 0x7fffffffU) / float(0x7fffffff);
+}
+
+void main ()
+{
+    position = particlePosition;
+    velocity = particleVelocity;
+    color = particleColor;
+
+    // (Re)spawn the particles a burst claimed, flying out and up from its origin
+    for (int b = 0; b < Bursts; b++)
+        if ((gl_VertexID - BurstFirst[b] + NumParticles) % NumParticles < BurstSize)
+        {
+            uint n = uint(gl_VertexID) * 4U + Seed * 2654435761U;
+            float angle = 6.2831853 * random(n), speed = 0.5 + 2.5 * random(n + 1U);
+            position = vec4(BurstOrigin[b], 0.0);
+            velocity = vec4(cos(angle) * speed, 2.0 + 4.0 * random(n + 2U), sin(angle) * speed, 0.6 + 0.9 * random(n + 3U));
+            color = vec4(BurstColor[b] * (0.6 + 0.4 * random(n + 1U)), 1.0);
+            return;
+        }
+
+    if (velocity.w <= 0.0)
+        return;
+    position.w += DeltaTime;
+    if (position.w >= velocity.w)
+    {
+        velocity.w = 0.0;
+        return;
+    }
+    velocity.y -= 9.8 * DeltaTime;
+    position.xyz += velocity.xyz * DeltaTime;
+}
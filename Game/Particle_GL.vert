@@ -0,0 +1,30 @@
+#version 330 core
+
+// input data : the particle buffer the last update wrote
+layout (location = 0) in vec4 particlePosition;     // xyz, w: age in seconds
+layout (location = 1) in vec4 particleVelocity;     // xyz, w: lifetime in seconds, 0 once dead
+layout (location = 2) in vec4 particleColor;
+
+uniform mat4 VP;
+uniform float PointSize;                // pixels across at a clip space w of 1
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Dead particles end up outside the view, like the missing tiles of the pulled board
+    if (particleVelocity.w <= 0.0)
+    {
+        fragColor = vec3(0.0);
+        gl_PointSize = 1.0;
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    // Particles shrink and darken as they age
+    float left = 1.0 - particlePosition.w / particleVelocity.w;
+    fragColor = particleColor.rgb * (0.4 + 0.6 * left);
+    gl_Position = VP * vec4(particlePosition.xyz, 1);
+    gl_PointSize = max(1.0, PointSize * left / gl_Position.w);
+}
@@ -0,0 +1,66 @@
+#version 330 core
+
+// No vertex attributes: gl_InstanceID picks the tile, gl_VertexID the corner of its prism
+// (0-29) or of the spikes of its obstacle (30-53)
+uniform vec3 Corners[54];               // in tile space
+uniform vec3 Colors[54];
+uniform vec3 ObstacleTopColors[6];      // replace the last six tile colors under an obstacle
+
+uniform ivec2 BoardMin;                 // first tile (x, z)
+uniform int BoardWidth;                 // tiles per row
+uniform int BoardDepth;                 // rows
+uniform int RandVal;
+uniform int OldRandVal;                 // layout before the last change
+uniform int ModVal;
+
+uniform float LayoutTime;               // seconds since RandVal replaced OldRandVal
+uniform float TransitionLength;         // seconds a single tile takes to rise or sink
+
+uniform mat4 VP;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+// Same rules as the game, which uses C's %; GLSL leaves % of negative values undefined,
+// and a multiple of ModVal stays one under abs()
+bool isObstacle (int i, int j, int layoutVal)
+{
+    return abs(2*i + 3*j + layoutVal) % ModVal == 0;
+}
+
+bool isHole (int i, int j, int layoutVal)
+{
+    return i + j == layoutVal && layoutVal != 0;
+}
+
+void main ()
+{
+    int i = BoardMin.x + gl_InstanceID % BoardWidth;
+    int j = BoardMin.y + gl_InstanceID / BoardWidth;
+    int v = gl_VertexID;
+
+    bool obstacle = isObstacle(i, j, RandVal), wasObstacle = isObstacle(i, j, OldRandVal);
+    bool present = v < 30 ? !isHole(i, j, RandVal) : obstacle;
+    bool wasPresent = v < 30 ? !isHole(i, j, OldRandVal) : wasObstacle;
+
+    // After a layout change, tiles and spikes that come or go rise into place or sink away, in a
+    // wave running from the first tile to the last
+    float wave = float((i - BoardMin.x) + (j - BoardMin.y)) / float(BoardWidth + BoardDepth);
+    float t = smoothstep(0.0, 1.0, LayoutTime / TransitionLength - wave);
+    float shown = present ? (wasPresent ? 1.0 : t) : (wasPresent ? 1.0 - t : 0.0);
+
+    // Collapse the corners of a missing tile or obstacle onto one point outside the view
+    if (shown <= 0.0)
+    {
+        fragColor = vec3(0.0);
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    // Sunk far enough, a tile is out of sight below the board and spikes are inside their tile
+    float sunk = (v < 30 ? 3.0 : 2.5) * (1.0 - shown);
+    fragColor = Colors[v];
+    if (v >= 24 && v < 30)
+        fragColor = mix(wasObstacle ? ObstacleTopColors[v - 24] : Colors[v], obstacle ? ObstacleTopColors[v - 24] : Colors[v], t);
+    gl_Position = VP * vec4(Corners[v] + vec3(i, (v < 30 ? 0.0 : 1.0) - sunk, j), 1);
+}
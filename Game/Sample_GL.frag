@@ -3,11 +3,20 @@
 // Interpolated values from the vertex shaders
 in vec3 fragColor;
 
+// Overdraw view: every fragment adds this color instead, (0, 0, 0) otherwise
+uniform vec3 Overdraw;
+
 // output data
 out vec3 color;
 
 void main()
 {
+    if (Overdraw != vec3(0.0))
+    {
+        color = Overdraw;
+        return;
+    }
+
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
     color = fragColor;
@@ -0,0 +1,26 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// MVPs of the whole frame, 4 texels (columns) per matrix
+uniform samplerBuffer Transforms;
+uniform int TransformIndex;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    int base = 4*TransformIndex;
+    mat4 MVP = mat4(texelFetch(Transforms, base),
+                    texelFetch(Transforms, base+1),
+                    texelFetch(Transforms, base+2),
+                    texelFetch(Transforms, base+3));
+
+    fragColor = vertexColor;
+
+    // Output position of the vertex, in clip space : MVP * position
+    gl_Position = MVP * vec4(vertexPosition, 1);
+}
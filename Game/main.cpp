@@ -2,8 +2,17 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -15,16 +24,41 @@
 
 using namespace std;
 
+#define ON 1
+#define OFF 0
+
 void movePlayer();
+void destroyMeshes();
+void destroyTransformBuffer();
+void destroyStreamBuffer();
+void destroyGpuTimers();
+void destroyHud();
+void destroyRenderTarget();
+const char* viewName();
+extern float renderScale;
+
+/* Layout of the single interleaved VBO of a mesh */
+enum VertexFormat {
+    VERTEX_FLOAT,       // 3 x float position, 3 x float color  - 24 bytes
+    VERTEX_HALF,        // 3 x half position (+pad), RGBA8 color - 12 bytes
+    VERTEX_BYTE,        // 3 x byte integer position (+pad), RGBA8 color - 8 bytes
+    VERTEX_AUTO         // most compact format that holds the positions
+};
 
 struct VAO {
     GLuint VertexArrayID;
-    GLuint VertexBuffer;
-    GLuint ColorBuffer;
+    GLuint VertexBuffer;    // interleaved position + color
+    GLuint AltColorBuffer;  // optional attribute 2 - color used by instances in the alternate state
+    GLuint InstanceBuffer;  // optional attribute 3 - per instance offset and state
+    GLuint IndexBuffer;     // optional element buffer - vertices shared between faces
 
+    VertexFormat Format;
     GLenum PrimitiveMode;
     GLenum FillMode;
     int NumVertices;
+    int NumInstances;       // used when InstanceBuffer is set
+    int NumIndices;         // used when IndexBuffer is set
+    GLenum IndexType;
 };
 typedef struct VAO VAO;
 
@@ -40,9 +74,14 @@ struct Point
 	float x, y, z;
 };
 GLuint programID;
+GLuint instancedProgramID, instancedVPID, instancedLayoutTimeID;
+GLuint boardProgramID, boardVPID;
+GLuint pulledProgramID, pulledVPID;
+GLuint particleProgramID, particleVPID;
 
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+/* Function to load Shaders - Use it as it is. feedbackVaryings names the outputs captured by
+   transform feedback, in buffer order */
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char* const* feedbackVaryings=NULL, int numFeedbackVaryings=0) {
 
 	// Create the shaders
 	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
@@ -103,6 +142,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if(numFeedbackVaryings>0)
+		glTransformFeedbackVaryings(ProgramID, numFeedbackVaryings, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -125,97 +166,508 @@ static void error_callback(int error, const char* description)
 
 void quit(GLFWwindow *window)
 {
+    destroyMeshes();
+    destroyTransformBuffer();
+    destroyStreamBuffer();
+    destroyGpuTimers();
+    destroyHud();
+    destroyRenderTarget();
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Counters of GL objects created while rendering a frame - should stay at zero after initGL() */
+struct FrameStats {
+	int frame;
+	int vaosCreated;
+	int buffersCreated;
+	int totalVaos;
+	int totalBuffers;
+	int vertexBytes;		// size of all mesh VBOs
+	int drawCalls;
+	int stateChanges;		// GL state calls issued ...
+	int stateChangesElided;	// ... and skipped because the state was already set
+	int transformUploads;	// transform buffer updates
+	int uniformUpdates;		// per draw uniform calls issued by the render queue
+	int cullTested;			// tiles, obstacles or chunks tested against the view frustum ...
+	int culled;				// ... and skipped
+	int streamedBytes;		// written to the stream buffer ...
+	int streamOrphans;		// ... and times it was full and orphaned
+	double frameStart;		// after the event wait, when drawing begins
+	double frameMs;			// from frameStart to the end of the swap, smoothed - time spent waiting for input is not counted
+	double lastSwapTime;
+	double swapMs;			// time between swaps, smoothed
+	double cpuMs;			// from frameStart to just before the swap, smoothed
+	double gpuMs;			// GPU time of a frame, smoothed, 0 until the first one is read back
+} frameStats;
+int showStats = OFF;
+
+//-----------------------------------GL STATE CACHE------------------------------------------------------
+
+/* Shadow of the GL state the draw path touches, so redundant calls can be skipped */
+struct GLStateCache {
+	GLuint program;
+	GLuint vertexArray;
+	GLenum polygonMode;
+} glState = { 0, 0, GL_FILL };
+
+void useProgram (GLuint program)
+{
+	if (glState.program == program) {
+		frameStats.stateChangesElided++;
+		return;
+	}
+	frameStats.stateChanges++;
+	glState.program = program;
+	glUseProgram(program);
+}
+
+void bindVertexArray (GLuint vertexArray)
+{
+	if (glState.vertexArray == vertexArray) {
+		frameStats.stateChangesElided++;
+		return;
+	}
+	frameStats.stateChanges++;
+	glState.vertexArray = vertexArray;
+	glBindVertexArray(vertexArray);
+}
+
+void setPolygonMode (GLenum mode)
+{
+	if (glState.polygonMode == mode) {
+		frameStats.stateChangesElided++;
+		return;
+	}
+	frameStats.stateChanges++;
+	glState.polygonMode = mode;
+	glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+VertexFormat forcedVertexFormat = VERTEX_AUTO;	// --vertex-format overrides the per mesh choice
+
+/* Convert a float to IEEE half precision (round to nearest, tiny values flush to zero) */
+GLushort floatToHalf (float f)
+{
+    unsigned int x;
+    memcpy(&x, &f, sizeof(x));
+    unsigned int sign = (x>>16) & 0x8000;
+    int exponent = (int)((x>>23) & 0xff) - 127 + 15;
+    unsigned int mantissa = x & 0x7fffff;
+
+    if (exponent <= 0)
+        return (GLushort)sign;
+    if (exponent >= 31)
+        return (GLushort)(sign | 0x7c00);
+    unsigned int h = sign | (exponent<<10) | (mantissa>>13);
+    if (mantissa & 0x1000)
+        h++;
+    return (GLushort)h;
+}
+
+float halfToFloat (GLushort h)
+{
+    unsigned int sign = (h & 0x8000) << 16;
+    int exponent = (h>>10) & 0x1f;
+    unsigned int mantissa = h & 0x3ff;
+    unsigned int x = sign;
+
+    if (exponent == 31)
+        x |= 0x7f800000 | (mantissa<<13);
+    else if (exponent != 0)
+        x |= ((exponent - 15 + 127)<<23) | (mantissa<<13);
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+int vertexStride (VertexFormat format)
+{
+    switch (format) {
+        case VERTEX_HALF: return 12;
+        case VERTEX_BYTE: return 8;
+        default: return 24;
+    }
+}
+
+/* Pick the smallest format that stores the positions exactly enough */
+VertexFormat chooseVertexFormat (int numVertices, const GLfloat* vertex_buffer_data)
+{
+    if (forcedVertexFormat != VERTEX_AUTO)
+        return forcedVertexFormat;
+
+    bool integers = true, small = true;
+    for (int i=0; i<3*numVertices; i++) {
+        GLfloat v = vertex_buffer_data[i];
+        if (v != floorf(v) || v < -128 || v > 127)
+            integers = false;
+        if (fabsf(halfToFloat(floatToHalf(v)) - v) > 1.0f/512)
+            small = false;
+    }
+    if (integers)
+        return VERTEX_BYTE;
+    if (small)
+        return VERTEX_HALF;
+    return VERTEX_FLOAT;
+}
+
+/* Interleave positions and colors into the layout of the given format */
+void packVertices (VertexFormat format, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, vector<unsigned char>& out)
+{
+    int stride = vertexStride(format);
+    out.assign(stride*numVertices, 0);
+
+    for (int i=0; i<numVertices; i++) {
+        unsigned char* v = &out[stride*i];
+        const GLfloat* pos = vertex_buffer_data + 3*i;
+        const GLfloat* col = color_buffer_data + 3*i;
+
+        if (format == VERTEX_FLOAT) {
+            memcpy(v, pos, 3*sizeof(GLfloat));
+            memcpy(v + 12, col, 3*sizeof(GLfloat));
+            continue;
+        }
+        if (format == VERTEX_HALF) {
+            GLushort* h = (GLushort*) v;
+            for (int k=0; k<3; k++)
+                h[k] = floatToHalf(pos[k]);
+        }
+        else {
+            for (int k=0; k<3; k++)
+                v[k] = (unsigned char)(signed char) pos[k];
+        }
+        unsigned char* c = v + stride - 4;
+        for (int k=0; k<3; k++)
+            c[k] = (unsigned char)(min(max(col[k], 0.0f), 1.0f)*255.0f + 0.5f);
+        c[3] = 255;
+    }
+}
+
+/* Point attribute 0 (position) and 1 (color) at the currently bound VBO */
+void setVertexFormat (VertexFormat format)
+{
+    int stride = vertexStride(format);
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    switch (format) {
+        case VERTEX_HALF:
+            glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, (void*)0);
+            glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)8);
+            break;
+        case VERTEX_BYTE:
+            glVertexAttribPointer(0, 3, GL_BYTE, GL_FALSE, stride, (void*)0);
+            glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)4);
+            break;
+        default:
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)12);
+            break;
+    }
+}
+
+/* Generate VAO, VBO and return VAO handle */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL, VertexFormat format=VERTEX_AUTO)
 {
     struct VAO* vao = new struct VAO;
+    frameStats.vaosCreated++;
+    frameStats.buffersCreated++;
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
     vao->FillMode = fill_mode;
+    vao->AltColorBuffer = 0;
+    vao->InstanceBuffer = 0;
+    vao->NumInstances = 0;
+    vao->IndexBuffer = 0;
+    vao->NumIndices = 0;
+    vao->IndexType = GL_UNSIGNED_SHORT;
+    vao->Format = (format == VERTEX_AUTO) ? chooseVertexFormat(numVertices, vertex_buffer_data) : format;
+
+    vector<unsigned char> interleaved;
+    packVertices(vao->Format, numVertices, vertex_buffer_data, color_buffer_data, interleaved);
+    frameStats.vertexBytes += interleaved.size();
 
     // Create Vertex Array Object
     // Should be done after CreateWindow and before any other GL calls
     glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-                          0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
+    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices and colors
+
+    bindVertexArray (vao->VertexArrayID); // Bind the VAO 
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO
+    glBufferData (GL_ARRAY_BUFFER, interleaved.size(), interleaved.empty() ? NULL : &interleaved[0], GL_STATIC_DRAW); // Copy the vertices into VBO
+    setVertexFormat(vao->Format);
 
     return vao;
 }
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+/* Generate VAO, VBO from vertex data already packed in format */
+struct VAO* createPackedObject (GLenum primitive_mode, VertexFormat format, int numVertices, const void* packed_data)
+{
+    struct VAO* vao = create3DObject(primitive_mode, 0, NULL, (const GLfloat*)NULL, GL_FILL, format);
+    int bytes = numVertices*vertexStride(format);
+    frameStats.vertexBytes += bytes;
+    vao->NumVertices = numVertices;
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+    glBufferData (GL_ARRAY_BUFFER, bytes, packed_data, GL_STATIC_DRAW);
+    return vao;
+}
+
+/* Replace the vertices of vao, keeping its format and GL objects */
+void update3DObject (struct VAO* vao, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data)
+{
+    vector<unsigned char> interleaved;
+    packVertices(vao->Format, numVertices, vertex_buffer_data, color_buffer_data, interleaved);
+    frameStats.vertexBytes += interleaved.size() - vertexStride(vao->Format)*vao->NumVertices;
+    vao->NumVertices = numVertices;
+
+    bindVertexArray (vao->VertexArrayID);
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+    glBufferData (GL_ARRAY_BUFFER, interleaved.size(), interleaved.empty() ? NULL : &interleaved[0], GL_STATIC_DRAW);
+}
+
+/* Generate VAO, VBO and return VAO handle - Common Color for all vertices */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL, VertexFormat format=VERTEX_AUTO)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+    vector<GLfloat> color_buffer_data (3*numVertices);
     for (int i=0; i<numVertices; i++) {
         color_buffer_data [3*i] = red;
         color_buffer_data [3*i + 1] = green;
         color_buffer_data [3*i + 2] = blue;
     }
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode, format);
+}
+
+/* VAO without any buffers, for shaders that make up their vertices from gl_VertexID and gl_InstanceID */
+struct VAO* createPulledObject (GLenum primitive_mode, int numVertices, int numInstances)
+{
+    struct VAO* vao = new struct VAO;
+    frameStats.vaosCreated++;
+    memset(vao, 0, sizeof(*vao));
+    vao->PrimitiveMode = primitive_mode;
+    vao->NumVertices = numVertices;
+    vao->NumInstances = numInstances;
+    vao->FillMode = GL_FILL;
+    vao->Format = VERTEX_FLOAT;
+    vao->IndexType = GL_UNSIGNED_SHORT;
+    glGenVertexArrays(1, &(vao->VertexArrayID));    // core profile draws need one bound, even if empty
+    return vao;
+}
+
+/* Add the colors an instance in the alternate state is drawn with (attribute 2, RGBA8) */
+void attachAltColors (struct VAO* vao, const GLfloat* color_buffer_data)
+{
+    vector<unsigned char> colors (4*vao->NumVertices);
+    for (int i=0; i<vao->NumVertices; i++) {
+        for (int k=0; k<3; k++)
+            colors[4*i+k] = (unsigned char)(min(max(color_buffer_data[3*i+k], 0.0f), 1.0f)*255.0f + 0.5f);
+        colors[4*i+3] = 255;
+    }
+
+    frameStats.buffersCreated++;
+    frameStats.vertexBytes += colors.size();
+    glGenBuffers (1, &(vao->AltColorBuffer));
+    bindVertexArray (vao->VertexArrayID);
+    glBindBuffer (GL_ARRAY_BUFFER, vao->AltColorBuffer);
+    glBufferData (GL_ARRAY_BUFFER, colors.size(), &colors[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void*)0);
+}
+
+/* Per instance data of an instanced mesh: tile offset and state bits (INSTANCE_ALT and the rest) */
+struct TileInstance {
+    GLshort x, y, z, state;
+};
+
+/* Replace the instances of vao - only needed when the layout changes */
+void setInstances (struct VAO* vao, const vector<TileInstance>& instances)
+{
+    bindVertexArray (vao->VertexArrayID);
+    if (vao->InstanceBuffer == 0) {
+        frameStats.buffersCreated++;
+        glGenBuffers (1, &(vao->InstanceBuffer));
+        glBindBuffer (GL_ARRAY_BUFFER, vao->InstanceBuffer);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_SHORT, GL_FALSE, sizeof(TileInstance), (void*)0);
+        glVertexAttribDivisor(3, 1);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, vao->InstanceBuffer);
+    glBufferData (GL_ARRAY_BUFFER, instances.size()*sizeof(TileInstance), instances.empty() ? NULL : &instances[0], GL_DYNAMIC_DRAW);
+    vao->NumInstances = instances.size();
+}
+
+void setIndexData (struct VAO* vao, const void* data, int numIndices, GLenum type);
+
+/* Replace the element buffer of vao - 16 bit indices whenever they fit */
+void setIndices (struct VAO* vao, const vector<GLuint>& indices)
+{
+    GLuint maxIndex = 0;
+    for (size_t i=0; i<indices.size(); i++)
+        maxIndex = max(maxIndex, indices[i]);
+
+    if (maxIndex < 65536) {
+        vector<GLushort> shorts (indices.begin(), indices.end());
+        setIndexData(vao, shorts.empty() ? NULL : &shorts[0], shorts.size(), GL_UNSIGNED_SHORT);
+    }
+    else
+        setIndexData(vao, &indices[0], indices.size(), GL_UNSIGNED_INT);
+}
+
+/* Replace the element buffer of vao with indices already in their final type */
+void setIndexData (struct VAO* vao, const void* data, int numIndices, GLenum type)
+{
+    int oldBytes = vao->NumIndices * (vao->IndexType == GL_UNSIGNED_INT ? 4 : 2);
+    int bytes = numIndices * (type == GL_UNSIGNED_INT ? 4 : 2);
+    frameStats.vertexBytes += bytes - oldBytes;
+    vao->NumIndices = numIndices;
+    vao->IndexType = type;
+
+    // The element buffer binding is VAO state, so it has to be made with the VAO bound
+    bindVertexArray (vao->VertexArrayID);
+    if (vao->IndexBuffer == 0) {
+        frameStats.buffersCreated++;
+        glGenBuffers (1, &(vao->IndexBuffer));
+    }
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, vao->IndexBuffer);
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
 }
 
 /* Render the VBOs handled by VAO */
 void draw3DObject (struct VAO* vao)
 {
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    setPolygonMode (vao->FillMode);
 
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
+    // Bind the VAO to use - it holds the attribute setup and VBO bindings
+    bindVertexArray (vao->VertexArrayID);
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    // Draw the geometry !
+    frameStats.drawCalls++;
+    if (vao->IndexBuffer && vao->InstanceBuffer)
+        glDrawElementsInstanced(vao->PrimitiveMode, vao->NumIndices, vao->IndexType, (void*)0, vao->NumInstances);
+    else if (vao->IndexBuffer)
+        glDrawElements(vao->PrimitiveMode, vao->NumIndices, vao->IndexType, (void*)0);
+    else if (vao->InstanceBuffer || vao->NumInstances)
+        glDrawArraysInstanced(vao->PrimitiveMode, 0, vao->NumVertices, vao->NumInstances);
+    else
+        glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+}
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+/* GPU memory held by the vertex and index buffers of vao */
+int meshBytes (struct VAO* vao)
+{
+    return vao->NumVertices*vertexStride(vao->Format) + vao->NumIndices*(vao->IndexType == GL_UNSIGNED_INT ? 4 : 2);
+}
 
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* Release the VAO and its VBOs */
+void delete3DObject (struct VAO* vao)
+{
+    glDeleteBuffers (1, &(vao->VertexBuffer));
+    glDeleteBuffers (1, &(vao->AltColorBuffer));
+    glDeleteBuffers (1, &(vao->InstanceBuffer));
+    glDeleteBuffers (1, &(vao->IndexBuffer));
+    glDeleteVertexArrays (1, &(vao->VertexArrayID));
+    if (glState.vertexArray == vao->VertexArrayID)
+        glState.vertexArray = 0;    // deleting the bound VAO reverts to 0
+    delete vao;
+}
+
+/* Fold the counters of the previous frame into the totals and start counting a new frame */
+void beginFrameStats ()
+{
+	frameStats.totalVaos+=frameStats.vaosCreated;
+	frameStats.totalBuffers+=frameStats.buffersCreated;
+	frameStats.vaosCreated=0;
+	frameStats.buffersCreated=0;
+	frameStats.drawCalls=0;
+	frameStats.stateChanges=0;
+	frameStats.stateChangesElided=0;
+	frameStats.transformUploads=0;
+	frameStats.uniformUpdates=0;
+	frameStats.cullTested=0;
+	frameStats.culled=0;
+	frameStats.streamedBytes=0;
+	frameStats.streamOrphans=0;
+	frameStats.frameStart = glfwGetTime();
+}
+
+/* Call once the frame is swapped: time it, print the counters if asked and move on to the next frame */
+void reportFrameStats ()
+{
+	double now = glfwGetTime();
+	double ms = (now-frameStats.frameStart)*1000.0;
+	frameStats.frameMs = frameStats.frameMs==0 ? ms : frameStats.frameMs*0.9 + ms*0.1;
+	if(frameStats.lastSwapTime>0)
+	{
+		ms = (now-frameStats.lastSwapTime)*1000.0;
+		frameStats.swapMs = frameStats.swapMs==0 ? ms : frameStats.swapMs*0.9 + ms*0.1;
+	}
+	frameStats.lastSwapTime = now;
+
+	if(showStats==ON && frameStats.frame%60==0)
+		printf("frame %d (%s view, %.2f ms, %.2f ms CPU, %.2f ms GPU, render scale %.2f): %d draw calls, %d/%d culled, %d state changes (%d elided), %d uniform updates, %d transform uploads, %d bytes streamed (%d orphans), %d VAOs, %d VBOs created (%d VAOs, %d VBOs, %d vertex bytes in total)\n", frameStats.frame, viewName(), frameStats.frameMs, frameStats.cpuMs, frameStats.gpuMs, renderScale,
+			frameStats.drawCalls, frameStats.culled, frameStats.cullTested, frameStats.stateChanges, frameStats.stateChangesElided, frameStats.uniformUpdates, frameStats.transformUploads, frameStats.streamedBytes, frameStats.streamOrphans, frameStats.vaosCreated, frameStats.buffersCreated,
+			frameStats.totalVaos+frameStats.vaosCreated, frameStats.totalBuffers+frameStats.buffersCreated, frameStats.vertexBytes);
+	frameStats.frame++;
+}
+
+//-----------------------------------MESH REGISTRY------------------------------------------------------
+
+/* Every distinct mesh is created once from initGL() and looked up by its handle while drawing */
+typedef int MeshHandle;
+vector<VAO*> meshRegistry;
+
+MeshHandle registerMesh (VAO* vao)
+{
+	meshRegistry.push_back(vao);
+	return (MeshHandle)meshRegistry.size()-1;
 }
 
+VAO* getMesh (MeshHandle mesh)
+{
+	return meshRegistry[mesh];
+}
+
+void draw3DObject (MeshHandle mesh)
+{
+	draw3DObject(getMesh(mesh));
+}
+
+void destroyMeshes ()
+{
+	for(size_t i=0; i<meshRegistry.size(); i++)
+		delete3DObject(meshRegistry[i]);
+	meshRegistry.clear();
+}
+
+#define LAYOUT_COUNT 10			// randVal only ever takes the values rand() % 10
+
+/* Handles of all the meshes used by the game */
+struct GameMeshes {
+	MeshHandle tile;				// closed tile prism, indexed
+	MeshHandle tileObstacle;		// same, with the top of a tile carrying an obstacle
+	MeshHandle obstacle;			// both spike pyramids of an obstacle
+	MeshHandle obstacleInstanced;	// same, one instance per obstacle of the board
+	MeshHandle player;				// player cube, indexed
+	MeshHandle axisX, axisY, axisZ;
+	MeshHandle tileInstanced;		// whole tile, one instance per tile of the board
+	MeshHandle board[LAYOUT_COUNT];	// exposed faces of each layout, merged into large quads
+	MeshHandle pulledBoard;			// no buffers - every tile and obstacle made up by Pulled_GL.vert
+	MeshHandle particles[2];		// particle points, each reading one of the two particle buffers
+} Meshes;
+
 //-----------------------------------GLOBAL OBJECTS------------------------------------------------------
 
 
 
 #define PI 3.141592653589
-#define ON 1
-#define OFF 0
 #define DEG2RAD(deg) (float)(deg * PI / 180)
 int windowWidth=800, windowHeight=800;
+int onDemand = OFF;				// redraw only when something marked the frame dirty
+int frameDirty = ON;
+int windowIconified = OFF, windowFocused = ON;
 float mouseX=0, mouseY=0, prevMouseX=0, prevMouseY=0;
 
 int adventureView = OFF;
@@ -236,144 +688,1267 @@ Point targetPos = { 0, 0, 0};
 Point frontPos = {0, 0, -1};
 Point upPos = { 0, 1, 0};
 glm::mat4 MVP, VP;
+int framebufferWidth=800, framebufferHeight=800;
+int renderWidth=800, renderHeight=800;		// part of the framebuffer or scene target the views draw to
+
+/* Split screen: the cameras below share one frame, each in a quarter of the window. The frame is
+   submitted, culled (against all of their frusta) and sorted once; only issuing the draws is
+   repeated per view. */
+#define MAX_VIEWS 4
+int splitScreen = OFF;
+int numViews = 1;
+glm::mat4 viewVPs[MAX_VIEWS];		// viewVPs[0] is VP
 
 int randVal=1, modVal=7, keyboardCount=0, countSteps=0;
+int boardMinX=-5, boardMaxX=5, boardMinZ=-4, boardMaxZ=6;	// tiles cover [boardMinX, boardMaxX) x [boardMinZ, boardMaxZ)
+
+/* How createLand() submits the board */
+enum LandMode { LAND_LEGACY, LAND_INSTANCED, LAND_BAKED, LAND_MESHED, LAND_PULLED, LAND_MODES };
+LandMode landMode = LAND_INSTANCED;
 
 VAO* obstacle();
-VAO* Rectangles1();
-VAO* Rectangles2();
-VAO* Triangles(int up);
+void createMeshes();
 
 //----------------------------------------------------------------------------------------------------------
 
-//------------------------------------KEYBOARD AND MOUSE FUNCTIONS--------------------------------------------
-void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+//------------------------------------STREAM BUFFER--------------------------------------------------------
+
+/* Data rewritten every frame (MVPs, HUD vertices) is appended to one large buffer through
+   unsynchronized maps. Nothing written there is overwritten while a draw may still read it, so
+   the driver never has to wait for the GPU. When the buffer is full it is orphaned - glBufferData
+   with no data hands the old storage to the draws still using it - and writing starts over at
+   the front of fresh storage. A single upload larger than the whole buffer makes it grow, up to
+   what the transform texture buffer can address. */
+#define STREAM_BUFFER_BYTES (1<<20)
+
+struct StreamBuffer {
+	GLuint buffer;
+	int size;
+	int maxSize;		// largest size the texture buffer over it can span
+	int offset;			// first free byte
+} Stream;
+
+void initStreamBuffer ()
 {
-     // Function is called first on GLFW_PRESS.
-    
-	
-    if (action == GLFW_PRESS) {
-        switch (key) {
-            case GLFW_KEY_RIGHT:
-            	keyboardCount++;
-            	if(adventureView==ON)
-            	{
-            		if(axis==4)
-            			axis=1;
-            		else if(axis==1)
-            			axis=3;
-            		else if(axis==3)
-            			axis=2;
-            		else if(axis==2)
-            			axis=4;
-            	}
-            	else
-            	{
-            		if((int)(2*(player.x+1)+3*player.z +randVal )% modVal != 0 && player.x+1<5)
-            		{	
-            			countSteps++;
-            			player.x+=1;
-            		}
-            		else
-            		{
-            			player.x=-5;
-            			player.z=5;
-            			score-=5;
-            		}
-            		axis=4;
-            	}
+	// the transforms are fetched through a texture buffer spanning all of it
+	GLint maxTexels;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	Stream.maxSize = min(maxTexels, 1<<26)*16;		// and at most 1 GB
+	Stream.size = min(STREAM_BUFFER_BYTES, Stream.maxSize);
+	Stream.offset = 0;
+
+	glGenBuffers(1, &Stream.buffer);
+	frameStats.buffersCreated++;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, Stream.buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, Stream.size, NULL, GL_STREAM_DRAW);
+}
 
-            	break;
-            case GLFW_KEY_LEFT:
-            	keyboardCount++;
-            	if(adventureView==ON)
-            	{
-            		if(axis==4)
-            			axis=2;
-            		else if(axis==2)
-            			axis=3;
-            		else if(axis==3)
-            			axis=1;
-            		else if(axis==1)
-            			axis=4;
-            	}
-            	else
-            	{
-            		if((int)(2*(player.x-1)+3*player.z +randVal)% modVal != 0 && player.x-1>=-5)
-            		{
-            			countSteps++;
-            			player.x-=1;
-            		}
-            		else
-            		{
-            			player.x=-5;
-            			player.z=5;
-            			score-=5;
-            		}
-            		axis=4;
-            	}
-            	break;
-            case GLFW_KEY_UP:
-            	keyboardCount++;
-            	if(adventureView==ON)
-            	{
-           			switch(axis)
-           			{
-           				case 4: 
-           					if((int)(2*player.x+3*(player.z-1) +randVal)% modVal != 0 && player.z-1>=-4)
-           					{
-           						countSteps++;
-            					player.z-=1;
-           					}
-           					else
-            				{
-            					player.x=-5;
-            					player.z=5;
-            					score-=5;
-            				}
-                			break;
-                		case 3:
-                			if((int)(2*player.x+3*(player.z+1) +randVal)% modVal != 0 && player.z+1<=5)
-                			{
-                				countSteps++;
-            					player.z+=1;
-                			}
-                			else
-            				{
-            					player.x=-5;
-            					player.z=5;
-            					score-=5;
-            				}
-                			break;
-                		case 2:
-                			if((int)(2*(player.x-1)+3*(player.z) +randVal)% modVal != 0 && player.x-1>=-5)
-                			{
-                				countSteps++;
-                				player.x-=1;
-                			}
-                			else
-            				{
-            					player.x=-5;
-            					player.z=5;
-            					score-=5;
-            				}
-                			break;
-                		case 1:
-                			if((int)(2*(player.x+1)+3*(player.z) +randVal)% modVal != 0 && player.x+1<=4)
-                			{
-                				countSteps++;
-            					player.x+=1;
-                			}
-                			else
-            				{
-            					player.x=-5;
-            					player.z=5;
-            					score-=5;
-            				}
-                			break;
-           			}
-           		}
-           		else
+void destroyStreamBuffer ()
+{
+	glDeleteBuffers(1, &Stream.buffer);
+}
+
+/* Copy bytes of data into the stream buffer at a multiple of alignment; returns the offset */
+int streamData (const void* data, int bytes, int alignment)
+{
+	int offset = (Stream.offset+alignment-1)/alignment*alignment;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, Stream.buffer);
+	if(bytes>Stream.size)
+	{
+		if(bytes>Stream.maxSize)
+		{
+			fprintf(stderr, "Cannot stream %d bytes in one upload - the stream buffer holds at most %d\n", bytes, Stream.maxSize);
+			exit(EXIT_FAILURE);
+		}
+		// the texture buffer spans the whole buffer, so it follows the new size
+		while(Stream.size<bytes)
+			Stream.size = min(Stream.size, Stream.maxSize/2)*2;
+		offset = Stream.size;		// forces the new storage below
+	}
+	if(offset+bytes>Stream.size)
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, Stream.size, NULL, GL_STREAM_DRAW);
+		frameStats.streamOrphans++;
+		offset = 0;
+	}
+	void* out = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	if(out!=NULL)
+	{
+		memcpy(out, data, bytes);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	}
+	else
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+	Stream.offset = offset+bytes;
+	frameStats.streamedBytes += bytes;
+	return offset;
+}
+
+//------------------------------------TRANSFORM BUFFER--------------------------------------------------------
+
+/* The MVPs of a frame are collected here and streamed with one buffer update; the vertex shader
+   fetches its matrix by index from a texture buffer over the stream buffer. */
+struct TransformBuffer {
+	GLuint texture;
+	int base;			// index in the texture buffer of the first MVP of this frame
+	vector<glm::mat4> transforms;
+} Transforms;
+
+int useTransformBuffer = ON;		// OFF: one glUniformMatrix4fv per draw, as before
+GLuint transformProgramID, transformIndexID;
+
+void initTransformBuffer ()
+{
+	transformProgramID = LoadShaders( "Transform_GL.vert", "Sample_GL.frag" );
+	transformIndexID = glGetUniformLocation(transformProgramID, "TransformIndex");
+	useProgram(transformProgramID);
+	glUniform1i(glGetUniformLocation(transformProgramID, "Transforms"), 0);
+
+	glGenTextures(1, &Transforms.texture);
+	glBindTexture(GL_TEXTURE_BUFFER, Transforms.texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, Stream.buffer);
+	Transforms.base=0;
+}
+
+void destroyTransformBuffer ()
+{
+	glDeleteTextures(1, &Transforms.texture);
+}
+
+/* Upload all MVPs queued this frame in one go */
+void uploadTransforms ()
+{
+	if(Transforms.transforms.empty())
+		return;
+
+	Transforms.base = streamData(&Transforms.transforms[0], Transforms.transforms.size()*sizeof(glm::mat4), sizeof(glm::mat4)) / sizeof(glm::mat4);
+	frameStats.transformUploads++;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, Transforms.texture);
+}
+
+//------------------------------------GPU TIMERS--------------------------------------------------------
+
+/* GL_TIMESTAMP queries are dropped at the start of a frame and wherever the phase of the issued
+   draws changes; the time between two timestamps is charged to the phase that started it. Each
+   frame uses its own set of queries from a ring and is read back GPU_TIMER_FRAMES frames later,
+   when the results are long available, so reading them never waits on the GPU. Every timestamp is
+   followed by a flush: software and tiling rasterizers such as Mesa's llvmpipe otherwise bin the
+   whole frame into one scene and the timestamps no longer separate the phases.
+   There are enough timestamps for every phase of every view twice over; phase changes past that
+   are charged to the phase before them and counted, so the output says when it happens. */
+enum RenderPhase { PHASE_CLEAR, PHASE_LAND, PHASE_OBSTACLES, PHASE_PLAYER, PHASE_PARTICLES, PHASE_HUD, PHASE_COUNT };
+
+#define GPU_TIMER_FRAMES 4
+#define GPU_TIMESTAMPS (2*MAX_VIEWS*PHASE_COUNT+2)	// per frame, including the start and end
+const char* phaseNames[PHASE_COUNT] = { "clear", "land", "obstacles", "player", "particles", "hud" };
+
+struct GpuTimerFrame {
+	GLuint queries[GPU_TIMESTAMPS];
+	RenderPhase phases[GPU_TIMESTAMPS];		// phase of the span starting at each timestamp
+	int count;
+	int frame;
+	int pending;
+};
+
+struct GpuTimers {
+	GpuTimerFrame frames[GPU_TIMER_FRAMES];
+	int current;
+	double sums[PHASE_COUNT];		// ms, over the frames since the last summary
+	int summed;
+	int dropped;					// frames whose results were not ready in time
+	int lostSpans;					// phase changes with no timestamp left, since the last summary
+	int totalLostSpans;
+	FILE* csv;
+} Timers;
+
+int gpuTimers = OFF;
+const char* gpuTimesFile = NULL;	// CSV output, one row per frame; NULL prints a summary instead
+
+void initGpuTimers ()
+{
+	if(gpuTimers==OFF)
+		return;
+
+	for(int f=0; f<GPU_TIMER_FRAMES; f++)
+	{
+		glGenQueries(GPU_TIMESTAMPS, Timers.frames[f].queries);
+		Timers.frames[f].count=0;
+		Timers.frames[f].pending=OFF;
+	}
+	Timers.current=0;
+	Timers.summed=0;
+	Timers.dropped=0;
+	Timers.lostSpans=0;
+	Timers.totalLostSpans=0;
+	for(int p=0; p<PHASE_COUNT; p++)
+		Timers.sums[p]=0;
+
+	Timers.csv=NULL;
+	if(gpuTimesFile!=NULL)
+	{
+		Timers.csv=fopen(gpuTimesFile, "w");
+		if(Timers.csv==NULL)
+			printf("Cannot write %s - printing GPU times instead\n", gpuTimesFile);
+		else
+		{
+			fprintf(Timers.csv, "frame");
+			for(int p=0; p<PHASE_COUNT; p++)
+				fprintf(Timers.csv, ",%s_ms", phaseNames[p]);
+			fprintf(Timers.csv, ",total_ms\n");
+		}
+	}
+}
+
+/* Read back a finished frame, if its last timestamp has landed or wait is ON */
+void resolveGpuFrame (GpuTimerFrame& f, int wait)
+{
+	GLint available = 0;
+	if(wait==OFF)
+		glGetQueryObjectiv(f.queries[f.count-1], GL_QUERY_RESULT_AVAILABLE, &available);
+	f.pending=OFF;
+	if(wait==OFF && !available)
+	{
+		Timers.dropped++;
+		return;
+	}
+
+	double ms[PHASE_COUNT] = { 0 }, total = 0;
+	GLuint64 previous, timestamp;
+	glGetQueryObjectui64v(f.queries[0], GL_QUERY_RESULT, &previous);
+	for(int k=1; k<f.count; k++)
+	{
+		glGetQueryObjectui64v(f.queries[k], GL_QUERY_RESULT, &timestamp);
+		ms[f.phases[k-1]] += (timestamp-previous)/1.0e6;
+		previous=timestamp;
+	}
+	for(int p=0; p<PHASE_COUNT; p++)
+	{
+		Timers.sums[p]+=ms[p];
+		total+=ms[p];
+	}
+	Timers.summed++;
+
+	if(Timers.csv!=NULL)
+	{
+		fprintf(Timers.csv, "%d", f.frame);
+		for(int p=0; p<PHASE_COUNT; p++)
+			fprintf(Timers.csv, ",%.4f", ms[p]);
+		fprintf(Timers.csv, ",%.4f\n", total);
+	}
+	else if(Timers.summed==60)
+	{
+		printf("GPU ms per frame (average of 60, %d dropped):", Timers.dropped);
+		for(int p=0; p<PHASE_COUNT; p++)
+			printf(" %s %.3f", phaseNames[p], Timers.sums[p]/Timers.summed);
+		if(Timers.lostSpans>0)
+			printf(" (%d phase changes untimed)", Timers.lostSpans);
+		printf("\n");
+	}
+	if(Timers.summed==60)
+	{
+		for(int p=0; p<PHASE_COUNT; p++)
+			Timers.sums[p]=0;
+		Timers.summed=0;
+		Timers.dropped=0;
+		Timers.lostSpans=0;
+	}
+}
+
+/* The last GPU_TIMER_FRAMES frames are still in the ring: wait for them, oldest first, so the CSV
+   ends with the frame the game quit on */
+void destroyGpuTimers ()
+{
+	if(gpuTimers==OFF)
+		return;
+	for(int k=1; k<=GPU_TIMER_FRAMES; k++)
+	{
+		GpuTimerFrame& f = Timers.frames[(Timers.current+k) % GPU_TIMER_FRAMES];
+		if(f.pending==ON)
+			resolveGpuFrame(f, ON);
+	}
+	if(Timers.totalLostSpans>0)
+		printf("GPU times: %d phase changes found no timestamp left and were charged to the phase before\n", Timers.totalLostSpans);
+	for(int f=0; f<GPU_TIMER_FRAMES; f++)
+		glDeleteQueries(GPU_TIMESTAMPS, Timers.frames[f].queries);
+	if(Timers.csv!=NULL)
+		fclose(Timers.csv);
+}
+
+/* Mark the start of a span of phase - only when the phase actually changes */
+void gpuTimestamp (RenderPhase phase)
+{
+	if(gpuTimers==OFF)
+		return;
+	GpuTimerFrame& f = Timers.frames[Timers.current];
+	if(f.count>0 && f.phases[f.count-1]==phase)
+		return;
+	if(f.count>=GPU_TIMESTAMPS-1)		// keep the last one for endGpuFrame()
+	{
+		Timers.lostSpans++;
+		Timers.totalLostSpans++;
+		return;
+	}
+	glQueryCounter(f.queries[f.count], GL_TIMESTAMP);
+	glFlush();
+	f.phases[f.count]=phase;
+	f.count++;
+}
+
+/* Start timing a frame in the oldest slot of the ring, reading that slot back first */
+void beginGpuFrame ()
+{
+	if(gpuTimers==OFF)
+		return;
+	Timers.current = (Timers.current+1) % GPU_TIMER_FRAMES;
+	GpuTimerFrame& f = Timers.frames[Timers.current];
+	if(f.pending==ON)
+		resolveGpuFrame(f, OFF);
+	f.count=0;
+	f.frame=frameStats.frame;
+	gpuTimestamp(PHASE_CLEAR);
+}
+
+void endGpuFrame ()
+{
+	if(gpuTimers==OFF)
+		return;
+	GpuTimerFrame& f = Timers.frames[Timers.current];
+	glQueryCounter(f.queries[f.count], GL_TIMESTAMP);
+	glFlush();
+	f.phases[f.count]=PHASE_COUNT;
+	f.count++;
+	f.pending=ON;
+}
+
+//------------------------------------RENDER QUEUE--------------------------------------------------------
+
+/* Game code only submits draw items during a frame. flushRenderQueue() sorts them so items sharing
+   a program, fill mode and mesh are drawn together, opaque ones front to back, and issues them. */
+enum RenderLayer {
+	LAYER_OPAQUE,		// sorted by state, then front to back
+	LAYER_OVERLAY		// drawn last, in submission order
+};
+
+struct DrawItem {
+	RenderLayer layer;
+	GLuint program;
+	GLenum fillMode;
+	MeshHandle mesh;
+	float depth;		// clip space z of the model origin
+	int transform;		// index into Transforms.transforms, -1 for instanced meshes placed by VP
+	int transformStride;	// view v uses the transform at transform + v*transformStride
+	int sequence;		// submission order
+};
+
+vector<DrawItem> renderQueue;
+int sortRenderQueue = ON;			// OFF: issue the items in submission order
+
+void submitDraw (MeshHandle mesh, GLuint program, int transform, int transformStride, float depth, RenderLayer layer)
+{
+	DrawItem item = { layer, program, getMesh(mesh)->FillMode, mesh, depth, transform, transformStride, (int)renderQueue.size() };
+	renderQueue.push_back(item);
+}
+
+/* Queue mesh placed by model */
+void drawModel (MeshHandle mesh, const glm::mat4& model, RenderLayer layer=LAYER_OPAQUE)
+{
+	MVP=VP*model;
+	submitDraw(mesh, useTransformBuffer==ON ? transformProgramID : programID, Transforms.transforms.size(), 1, MVP[3][2], layer);
+	for(int v=0; v<numViews; v++)
+		Transforms.transforms.push_back(viewVPs[v]*model);
+}
+
+/* Queue a mesh that is placed by VP alone - instanced meshes and meshes built in world space */
+void drawWorldSpace (MeshHandle mesh, GLuint program, RenderLayer layer=LAYER_OPAQUE)
+{
+	submitDraw(mesh, program, -1, 0, 0, layer);
+}
+
+/* Queue an instanced mesh - its instances carry their own world position */
+void drawInstanced (MeshHandle mesh, RenderLayer layer=LAYER_OPAQUE)
+{
+	drawWorldSpace(mesh, instancedProgramID, layer);
+}
+
+/* Which GPU timer phase the draws of mesh are charged to */
+RenderPhase meshPhase (MeshHandle mesh)
+{
+	if(mesh==Meshes.obstacle || mesh==Meshes.obstacleInstanced)
+		return PHASE_OBSTACLES;
+	if(mesh==Meshes.player)
+		return PHASE_PLAYER;
+	if(mesh==Meshes.particles[0] || mesh==Meshes.particles[1])
+		return PHASE_PARTICLES;
+	return PHASE_LAND;
+}
+
+bool drawItemBefore (const DrawItem& a, const DrawItem& b)
+{
+	if(a.layer!=b.layer)
+		return a.layer<b.layer;
+	if(a.layer!=LAYER_OPAQUE)
+		return a.sequence<b.sequence;
+	if(a.program!=b.program)
+		return a.program<b.program;
+	if(a.fillMode!=b.fillMode)
+		return a.fillMode<b.fillMode;
+	if(a.mesh!=b.mesh)
+		return a.mesh<b.mesh;
+	if(a.depth!=b.depth)
+		return a.depth<b.depth;
+	return a.sequence<b.sequence;
+}
+
+/* Where the programs drawing world space meshes take VP */
+GLint viewProjectionLocation (GLuint program)
+{
+	if(program==boardProgramID)
+		return boardVPID;
+	if(program==pulledProgramID)
+		return pulledVPID;
+	if(program==particleProgramID)
+		return particleVPID;
+	return instancedVPID;
+}
+
+/* Issue the sorted queue for view v */
+void issueRenderQueue (int v)
+{
+	GLuint viewProjectionSet = 0;		// program VP was last set on
+	for(size_t i=0; i<renderQueue.size(); i++)
+	{
+		const DrawItem& item = renderQueue[i];
+		int transform = item.transform + v*item.transformStride;
+		gpuTimestamp(meshPhase(item.mesh));
+		useProgram(item.program);
+		if(item.transform<0)
+		{
+			if(viewProjectionSet!=item.program)
+			{
+				glUniformMatrix4fv(viewProjectionLocation(item.program), 1, GL_FALSE, &viewVPs[v][0][0]);
+				frameStats.uniformUpdates++;
+			}
+			viewProjectionSet=item.program;
+		}
+		else if(item.program==transformProgramID)
+		{
+			glUniform1i(transformIndexID, Transforms.base+transform);
+			frameStats.uniformUpdates++;
+		}
+		else
+		{
+			glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &Transforms.transforms[transform][0][0]);
+			frameStats.uniformUpdates++;
+		}
+		draw3DObject(item.mesh);
+	}
+}
+
+/* Sort and issue everything submitted this frame, once per view */
+void flushRenderQueue ()
+{
+	if(sortRenderQueue==ON)
+		sort(renderQueue.begin(), renderQueue.end(), drawItemBefore);
+	if(useTransformBuffer==ON)
+		uploadTransforms();
+
+	if(numViews==1)
+		issueRenderQueue(0);
+	else
+	{
+		int w=renderWidth/2, h=renderHeight/2;
+		for(int v=0; v<numViews; v++)
+		{
+			glViewport((v%2)*w, (1-v/2)*h, w, h);		// left to right, top to bottom
+			issueRenderQueue(v);
+		}
+		glViewport(0, 0, renderWidth, renderHeight);
+	}
+	useProgram(programID);
+
+	renderQueue.clear();
+	Transforms.transforms.clear();
+}
+
+//------------------------------------BATCHED TRANSFORMS--------------------------------------------------------
+
+/* Every model matrix of the board is a pure translation, so VP*translate(p) is VP with its last
+   column replaced by VP*(p,1). translatedMVPs() computes that column for four meshes at a time
+   from positions kept as separate x, y and z arrays; the scalar loop handles the rest and any
+   build without SSE. */
+void translatedMVPs (const glm::mat4& vp, int n, const float* x, const float* y, const float* z, glm::mat4* out)
+{
+	int k=0;
+#ifdef __SSE__
+	for(; k+4<=n; k+=4)
+	{
+		__m128 px=_mm_loadu_ps(x+k), py=_mm_loadu_ps(y+k), pz=_mm_loadu_ps(z+k);
+		__m128 column[4];		// row r of the last column of each of the four MVPs
+		for(int r=0; r<4; r++)
+			column[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(vp[0][r]), px), _mm_mul_ps(_mm_set1_ps(vp[1][r]), py)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(vp[2][r]), pz), _mm_set1_ps(vp[3][r])));
+		_MM_TRANSPOSE4_PS(column[0], column[1], column[2], column[3]);	// now the last column of MVP m
+		for(int m=0; m<4; m++)
+		{
+			out[k+m][0]=vp[0];
+			out[k+m][1]=vp[1];
+			out[k+m][2]=vp[2];
+			_mm_storeu_ps(&out[k+m][3][0], column[m]);
+		}
+	}
+#endif
+	for(; k<n; k++)
+	{
+		out[k]=vp;
+		out[k][3]=(vp[0]*x[k] + vp[1]*y[k]) + (vp[2]*z[k] + vp[3]);
+	}
+}
+
+/* Meshes collected while walking the board, queued together by drawBatch() */
+struct TranslatedBatch {
+	vector<MeshHandle> meshes;
+	vector<float> x, y, z;
+} landBatch;
+
+void addToBatch (TranslatedBatch& batch, MeshHandle mesh, float x, float y, float z)
+{
+	batch.meshes.push_back(mesh);
+	batch.x.push_back(x);
+	batch.y.push_back(y);
+	batch.z.push_back(z);
+}
+
+void drawBatch (TranslatedBatch& batch, RenderLayer layer=LAYER_OPAQUE)
+{
+	int n=batch.meshes.size(), first=Transforms.transforms.size();
+	if(n==0)
+		return;
+	Transforms.transforms.resize(first+n*numViews);		// one block of n MVPs per view
+	for(int v=0; v<numViews; v++)
+		translatedMVPs(viewVPs[v], n, &batch.x[0], &batch.y[0], &batch.z[0], &Transforms.transforms[first+v*n]);
+	for(int k=0; k<n; k++)
+		submitDraw(batch.meshes[k], useTransformBuffer==ON ? transformProgramID : programID, first+k, n, Transforms.transforms[first+k][3][2], layer);
+
+	batch.meshes.clear();
+	batch.x.clear();
+	batch.y.clear();
+	batch.z.clear();
+}
+
+/* --bench-transforms: matrices per second of the batch against one glm product per mesh */
+void benchTransforms ()
+{
+	const int iterations = 20000;
+	vector<float> x, y, z;
+	for(int i=boardMinX; i<boardMaxX; i++)
+		for(int j=boardMinZ; j<boardMaxZ; j++)
+		{
+			x.push_back(i);
+			y.push_back((i+j)%3==0);
+			z.push_back(j);
+		}
+	int n=x.size();
+	glm::mat4 vp = glm::perspective(1.0f, 1.0f, 0.1f, 500.0f)*glm::lookAt(glm::vec3(-4,8,8), glm::vec3(0,0,0), glm::vec3(0,1,0));
+	vector<glm::mat4> scalar(n), batched(n);
+	volatile float sink=0;		// keeps the loops from being optimized away
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int it=0; it<iterations; it++)
+	{
+		for(int k=0; k<n; k++)
+			scalar[k] = vp*glm::translate(glm::vec3(x[k], y[k], z[k]));
+		sink+=scalar[it%n][3][0];
+	}
+	double scalarTime = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+	start = chrono::steady_clock::now();
+	for(int it=0; it<iterations; it++)
+	{
+		translatedMVPs(vp, n, &x[0], &y[0], &z[0], &batched[0]);
+		sink+=batched[it%n][3][0];
+	}
+	double batchTime = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+	float maxError=0;
+	for(int k=0; k<n; k++)
+		for(int c=0; c<4; c++)
+			for(int r=0; r<4; r++)
+				maxError=max(maxError, fabsf(scalar[k][c][r]-batched[k][c][r]));
+
+	double matrices = (double)iterations*n;
+#ifdef __SSE__
+	const char* kernel = "SSE";
+#else
+	const char* kernel = "scalar";
+#endif
+	printf("glm VP*translate: %.1f M matrices/s\n", matrices/scalarTime/1e6);
+	printf("batched (%s):     %.1f M matrices/s (%.1fx), max difference %g\n", kernel, matrices/batchTime/1e6, scalarTime/batchTime, maxError);
+}
+
+//------------------------------------HUD--------------------------------------------------------
+
+/* Score, lives and frame timings drawn over the scene. Text is formatted into fixed buffers and
+   turned into quads in a static array and streamed, so a frame allocates nothing; all of it, background
+   included, is one draw sampling a 5x7 pixel font kept in a single row texture atlas. */
+#define HUD_GLYPHS " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:-/#"	// '#' is a solid block
+#define HUD_GLYPH_COUNT 42
+#define HUD_CELL_WIDTH 6		// atlas cell: 5x7 glyph and a blank column and row
+#define HUD_CELL_HEIGHT 8
+#define HUD_SCALE 2				// screen pixels per font pixel
+#define HUD_MAX_QUADS 256
+
+/* Rows of each glyph, top first; bit 4 is the leftmost pixel */
+static const GLubyte hudFont[HUD_GLYPH_COUNT][7] = {
+	{ 0x00,0x00,0x00,0x00,0x00,0x00,0x00 },		// space
+	{ 0x0E,0x11,0x13,0x15,0x19,0x11,0x0E }, { 0x04,0x0C,0x04,0x04,0x04,0x04,0x0E },		// 0 1
+	{ 0x0E,0x11,0x01,0x02,0x04,0x08,0x1F }, { 0x1F,0x02,0x04,0x02,0x01,0x11,0x0E },		// 2 3
+	{ 0x02,0x06,0x0A,0x12,0x1F,0x02,0x02 }, { 0x1F,0x10,0x1E,0x01,0x01,0x11,0x0E },		// 4 5
+	{ 0x06,0x08,0x10,0x1E,0x11,0x11,0x0E }, { 0x1F,0x01,0x02,0x04,0x08,0x08,0x08 },		// 6 7
+	{ 0x0E,0x11,0x11,0x0E,0x11,0x11,0x0E }, { 0x0E,0x11,0x11,0x0F,0x01,0x02,0x0C },		// 8 9
+	{ 0x0E,0x11,0x11,0x11,0x1F,0x11,0x11 }, { 0x1E,0x11,0x11,0x1E,0x11,0x11,0x1E },		// A B
+	{ 0x0E,0x11,0x10,0x10,0x10,0x11,0x0E }, { 0x1C,0x12,0x11,0x11,0x11,0x12,0x1C },		// C D
+	{ 0x1F,0x10,0x10,0x1E,0x10,0x10,0x1F }, { 0x1F,0x10,0x10,0x1E,0x10,0x10,0x10 },		// E F
+	{ 0x0E,0x11,0x10,0x17,0x11,0x11,0x0F }, { 0x11,0x11,0x11,0x1F,0x11,0x11,0x11 },		// G H
+	{ 0x0E,0x04,0x04,0x04,0x04,0x04,0x0E }, { 0x07,0x02,0x02,0x02,0x02,0x12,0x0C },		// I J
+	{ 0x11,0x12,0x14,0x18,0x14,0x12,0x11 }, { 0x10,0x10,0x10,0x10,0x10,0x10,0x1F },		// K L
+	{ 0x11,0x1B,0x15,0x15,0x11,0x11,0x11 }, { 0x11,0x11,0x19,0x15,0x13,0x11,0x11 },		// M N
+	{ 0x0E,0x11,0x11,0x11,0x11,0x11,0x0E }, { 0x1E,0x11,0x11,0x1E,0x10,0x10,0x10 },		// O P
+	{ 0x0E,0x11,0x11,0x11,0x15,0x12,0x0D }, { 0x1E,0x11,0x11,0x1E,0x14,0x12,0x11 },		// Q R
+	{ 0x0F,0x10,0x10,0x0E,0x01,0x01,0x1E }, { 0x1F,0x04,0x04,0x04,0x04,0x04,0x04 },		// S T
+	{ 0x11,0x11,0x11,0x11,0x11,0x11,0x0E }, { 0x11,0x11,0x11,0x11,0x11,0x0A,0x04 },		// U V
+	{ 0x11,0x11,0x11,0x15,0x15,0x15,0x0A }, { 0x11,0x11,0x0A,0x04,0x0A,0x11,0x11 },		// W X
+	{ 0x11,0x11,0x11,0x0A,0x04,0x04,0x04 }, { 0x1F,0x01,0x02,0x04,0x08,0x10,0x1F },		// Y Z
+	{ 0x00,0x00,0x00,0x00,0x00,0x0C,0x0C }, { 0x00,0x0C,0x0C,0x00,0x0C,0x0C,0x00 },		// . :
+	{ 0x00,0x00,0x00,0x1F,0x00,0x00,0x00 }, { 0x00,0x01,0x02,0x04,0x08,0x10,0x00 },		// - /
+	{ 0x1F,0x1F,0x1F,0x1F,0x1F,0x1F,0x1F },		// #
+};
+
+struct HudVertex {
+	GLfloat x, y;		// pixels
+	GLfloat u, v;		// atlas texel
+	GLubyte color[4];
+};
+
+struct Hud {
+	GLuint program, vertexArray, atlas;
+	GLint screenSizeID;
+	GLubyte glyphOf[128];		// atlas cell of each ASCII character
+	HudVertex vertices[HUD_MAX_QUADS*6];
+	int numQuads;
+} hud;
+
+int showHud = ON;
+
+void initHud ()
+{
+	hud.program = LoadShaders( "Hud_GL.vert", "Hud_GL.frag" );
+	hud.screenSizeID = glGetUniformLocation(hud.program, "ScreenSize");
+	useProgram(hud.program);
+	glUniform1i(glGetUniformLocation(hud.program, "Atlas"), 1);
+
+	const char* glyphs = HUD_GLYPHS;
+	memset(hud.glyphOf, 0, sizeof(hud.glyphOf));
+	for(int g=0; g<HUD_GLYPH_COUNT; g++)
+		hud.glyphOf[(int)glyphs[g]] = g;
+
+	GLubyte atlas[HUD_CELL_HEIGHT][HUD_GLYPH_COUNT*HUD_CELL_WIDTH];
+	memset(atlas, 0, sizeof(atlas));
+	for(int g=0; g<HUD_GLYPH_COUNT; g++)
+		for(int r=0; r<7; r++)
+			for(int c=0; c<5; c++)
+				if(hudFont[g][r] & (0x10>>c))
+					atlas[r][g*HUD_CELL_WIDTH+c] = 255;
+	glGenTextures(1, &hud.atlas);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, hud.atlas);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, HUD_GLYPH_COUNT*HUD_CELL_WIDTH, HUD_CELL_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, atlas);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glActiveTexture(GL_TEXTURE0);
+
+	glGenVertexArrays(1, &hud.vertexArray);
+	frameStats.vaosCreated++;
+	bindVertexArray(hud.vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, Stream.buffer);		// the vertices of each frame are streamed
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)offsetof(HudVertex, x));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)offsetof(HudVertex, u));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (void*)offsetof(HudVertex, color));
+	bindVertexArray(0);
+}
+
+void destroyHud ()
+{
+	glDeleteTextures(1, &hud.atlas);
+	glDeleteVertexArrays(1, &hud.vertexArray);
+}
+
+/* Queue a quad covering the pixels [x0, x1) x [y0, y1), textured by the atlas texels from (u0, v0) */
+void hudQuad (float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const GLubyte* color)
+{
+	if(hud.numQuads==HUD_MAX_QUADS)
+		return;
+	HudVertex corners[4] = {
+		{ x0, y0, u0, v0, { color[0], color[1], color[2], color[3] } }, { x1, y0, u1, v0, { color[0], color[1], color[2], color[3] } },
+		{ x0, y1, u0, v1, { color[0], color[1], color[2], color[3] } }, { x1, y1, u1, v1, { color[0], color[1], color[2], color[3] } } };
+	HudVertex* out = &hud.vertices[hud.numQuads*6];
+	out[0]=corners[0]; out[1]=corners[1]; out[2]=corners[2];
+	out[3]=corners[1]; out[4]=corners[3]; out[5]=corners[2];
+	hud.numQuads++;
+}
+
+/* Queue line of text at row line, over a translucent backdrop */
+void hudText (int line, const char* text)
+{
+	static const GLubyte white[4] = { 255, 255, 255, 255 }, backdrop[4] = { 0, 0, 0, 140 };
+	float advance = HUD_CELL_WIDTH*HUD_SCALE, height = HUD_CELL_HEIGHT*HUD_SCALE;
+	float x = 2*HUD_SCALE, y = HUD_SCALE + line*(height+HUD_SCALE);
+	float solid = (HUD_GLYPH_COUNT-1)*HUD_CELL_WIDTH + 0.5f;
+	hudQuad(x-HUD_SCALE, y-HUD_SCALE, x+strlen(text)*advance, y+height, solid, 0.5f, solid, 0.5f, backdrop);
+
+	for(const char* c=text; *c; c++, x+=advance)
+	{
+		int g = hud.glyphOf[toupper(*c) & 127];
+		if(g==0)
+			continue;
+		float u = g*HUD_CELL_WIDTH;
+		hudQuad(x, y, x+5*HUD_SCALE, y+7*HUD_SCALE, u, 0, u+5, 7, white);
+	}
+}
+
+/* Build and draw the HUD of this frame, over whatever the views drew */
+void drawHud ()
+{
+	if(showHud==OFF)
+		return;
+
+	char line[64];
+	hud.numQuads = 0;
+	snprintf(line, sizeof(line), "SCORE %d  LIVES %d", score, lives);
+	hudText(0, line);
+	snprintf(line, sizeof(line), "FRAME %.1f MS  %.0f FPS  SCALE %.2f", frameStats.frameMs, frameStats.swapMs>0 ? 1000.0/frameStats.swapMs : 0.0, renderScale);
+	hudText(1, line);
+	snprintf(line, sizeof(line), "%d DRAWS  %d/%d CULLED  %.1f KB STREAMED", frameStats.drawCalls, frameStats.culled, frameStats.cullTested, frameStats.streamedBytes/1024.0);
+	hudText(2, line);
+
+	gpuTimestamp(PHASE_HUD);
+	int first = streamData(hud.vertices, hud.numQuads*6*sizeof(HudVertex), sizeof(HudVertex)) / sizeof(HudVertex);
+	useProgram(hud.program);
+	glUniform2f(hud.screenSizeID, framebufferWidth, framebufferHeight);
+	frameStats.uniformUpdates++;
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, hud.atlas);
+	glActiveTexture(GL_TEXTURE0);
+	setPolygonMode(GL_FILL);
+	bindVertexArray(hud.vertexArray);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_TRIANGLES, first, hud.numQuads*6);
+	frameStats.drawCalls++;
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	useProgram(programID);
+}
+
+//------------------------------------RENDER SCALING--------------------------------------------------------
+
+/* The views can draw into an offscreen target at a fraction of the window resolution, which is
+   then stretched over the window; the HUD is drawn afterwards at full resolution. The target is
+   allocated at window size once and only a corner of it is used, so changing the scale never
+   reallocates. Unless --render-scale fixes it, the scale follows the smoothed render cost: down
+   when frames cost more than the budget, back up when there is room to spare. The cost is what
+   the frame itself takes, without the wait for vertical sync in the swap, which would pin any
+   frame time at the refresh interval: the CPU time from the start of drawing to just before the
+   swap, and the GPU time of the frame between two GL_TIMESTAMP queries, flushed like the GPU
+   timers' for the same reason. The CPU prepares the next frame while the GPU draws this one, so
+   the slower of the two is the cost. The queries are read GPU_TIMER_FRAMES frames later and
+   skipped if they are not ready, so reading never waits. */
+#define MIN_RENDER_SCALE 0.5f
+#define RENDER_SCALE_STEP 0.05f
+#define RENDER_SCALE_INTERVAL 15		// frames between two changes, so the smoothed time can follow
+
+struct RenderTarget {
+	GLuint framebuffer, color, depth;
+	int width, height;
+} sceneTarget;
+
+float renderScale = 1.0f;
+int fixedRenderScale = OFF;
+float frameBudgetMs = 1000.0f/60;
+int lastScaleChange = 0;
+
+struct RenderCost {
+	GLuint queries[GPU_TIMER_FRAMES][2];	// start and end of each frame
+	int pending[GPU_TIMER_FRAMES];
+	int current;
+} renderCost;
+
+void initRenderTarget ()
+{
+	glGenFramebuffers(1, &sceneTarget.framebuffer);
+	glGenRenderbuffers(1, &sceneTarget.color);
+	glGenRenderbuffers(1, &sceneTarget.depth);
+	sceneTarget.width = sceneTarget.height = 0;
+
+	glGenQueries(2*GPU_TIMER_FRAMES, renderCost.queries[0]);
+	for(int f=0; f<GPU_TIMER_FRAMES; f++)
+		renderCost.pending[f]=OFF;
+	renderCost.current=0;
+}
+
+void destroyRenderTarget ()
+{
+	glDeleteQueries(2*GPU_TIMER_FRAMES, renderCost.queries[0]);
+	glDeleteRenderbuffers(1, &sceneTarget.depth);
+	glDeleteRenderbuffers(1, &sceneTarget.color);
+	glDeleteFramebuffers(1, &sceneTarget.framebuffer);
+}
+
+/* Read the GPU time of the oldest frame in the ring, if it is ready, and start timing this one */
+void beginRenderCost ()
+{
+	renderCost.current = (renderCost.current+1) % GPU_TIMER_FRAMES;
+	GLuint* queries = renderCost.queries[renderCost.current];
+	if(renderCost.pending[renderCost.current]==ON)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available)
+		{
+			GLuint64 start, end;
+			glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+			double ms = (end-start)/1.0e6;
+			frameStats.gpuMs = frameStats.gpuMs==0 ? ms : frameStats.gpuMs*0.9 + ms*0.1;
+		}
+		renderCost.pending[renderCost.current]=OFF;
+	}
+	glQueryCounter(queries[0], GL_TIMESTAMP);
+	glFlush();
+}
+
+/* Called last in draw(), before the swap */
+void endRenderCost ()
+{
+	glQueryCounter(renderCost.queries[renderCost.current][1], GL_TIMESTAMP);
+	glFlush();
+	renderCost.pending[renderCost.current]=ON;
+	double ms = (glfwGetTime()-frameStats.frameStart)*1000.0;
+	frameStats.cpuMs = frameStats.cpuMs==0 ? ms : frameStats.cpuMs*0.9 + ms*0.1;
+}
+
+/* Size the target to the window - only called when the window size changes */
+void resizeRenderTarget (int width, int height)
+{
+	// a minimized window can report 0x0 - keep the old size so the next real resize reallocates
+	if(width<=0 || height<=0 || (width==sceneTarget.width && height==sceneTarget.height))
+		return;
+	sceneTarget.width = width;
+	sceneTarget.height = height;
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneTarget.color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneTarget.depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneTarget.color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneTarget.depth);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)
+	{
+		fprintf(stderr, "Scene render target format unsupported - rendering at full resolution\n");
+		renderScale = 1.0f;
+		fixedRenderScale = ON;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* Step the scale towards the frame budget */
+void updateRenderScale ()
+{
+	double cost = max(frameStats.cpuMs, frameStats.gpuMs);
+	if(fixedRenderScale==ON || cost==0 || frameStats.frame-lastScaleChange<RENDER_SCALE_INTERVAL)
+		return;
+	float scale = renderScale;
+	if(cost > frameBudgetMs*1.05f)
+		scale = max(MIN_RENDER_SCALE, renderScale-RENDER_SCALE_STEP);
+	else if(cost < frameBudgetMs*0.8f)
+		scale = min(1.0f, renderScale+RENDER_SCALE_STEP);
+	if(scale!=renderScale)
+	{
+		renderScale = scale;
+		lastScaleChange = frameStats.frame;
+	}
+}
+
+/* Point the views at the scene target, or at the window when drawing at full resolution */
+void beginScene ()
+{
+	updateRenderScale();
+	if(renderScale<1.0f)
+	{
+		renderWidth = max(1, (int)(framebufferWidth*renderScale+0.5f));
+		renderHeight = max(1, (int)(framebufferHeight*renderScale+0.5f));
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.framebuffer);
+	}
+	else
+	{
+		renderWidth = framebufferWidth;
+		renderHeight = framebufferHeight;
+	}
+	glViewport(0, 0, renderWidth, renderHeight);
+}
+
+/* Stretch the scene over the window */
+void endScene ()
+{
+	if(renderScale<1.0f)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneTarget.framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, framebufferWidth, framebufferHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	glViewport(0, 0, framebufferWidth, framebufferHeight);
+}
+
+//------------------------------------OVERDRAW VIEW--------------------------------------------------------
+
+/* Debug view of how often each pixel is drawn. With depth testing off and additive blending every
+   fragment adds OVERDRAW_STEP: red saturates after 8 layers and blue after 64, giving a heatmap,
+   while green counts fragments exactly (up to 255). The counts are read back every 60 frames and
+   summarized on stdout, which is what headless runs check. */
+#define OVERDRAW_STEP 1.0f/8, 1.0f/255, 1.0f/64
+
+int overdrawView = OFF;
+int overdrawSet = OFF;			// state the programs' Overdraw uniforms were last given
+vector<GLubyte> overdrawPixels;
+
+/* Tell every scene program whether to output the overdraw step */
+void setOverdrawUniforms ()
+{
+	GLuint programs[] = { programID, transformProgramID, instancedProgramID, boardProgramID, pulledProgramID, particleProgramID };
+	for(size_t p=0; p<sizeof(programs)/sizeof(programs[0]); p++)
+	{
+		useProgram(programs[p]);
+		if(overdrawView==ON)
+			glUniform3f(glGetUniformLocation(programs[p], "Overdraw"), OVERDRAW_STEP);
+		else
+			glUniform3f(glGetUniformLocation(programs[p], "Overdraw"), 0, 0, 0);
+	}
+	overdrawSet = overdrawView;
+}
+
+void beginOverdraw ()
+{
+	if(overdrawSet!=overdrawView)
+		setOverdrawUniforms();
+	if(overdrawView==OFF)
+		return;
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+}
+
+/* Restore the normal state, summarizing the counts of the scene drawn since beginOverdraw() */
+void endOverdraw ()
+{
+	if(overdrawView==OFF)
+		return;
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	if(frameStats.frame%60!=0)
+		return;
+
+	int pixels = renderWidth*renderHeight;
+	overdrawPixels.resize(pixels*4);
+	glReadPixels(0, 0, renderWidth, renderHeight, GL_RGBA, GL_UNSIGNED_BYTE, &overdrawPixels[0]);
+	long fragments = 0;
+	int covered = 0, maxCount = 0;
+	for(int p=0; p<pixels; p++)
+	{
+		int count = overdrawPixels[4*p+1];
+		fragments += count;
+		covered += (count>0);
+		maxCount = max(maxCount, count);
+	}
+	printf("overdraw frame %d (%s view, %dx%d): %.2f fragments per pixel, %.2f per covered pixel (%.1f%% covered), max %d%s\n",
+		frameStats.frame, viewName(), renderWidth, renderHeight, (double)fragments/pixels, covered ? (double)fragments/covered : 0.0,
+		100.0*covered/pixels, maxCount, maxCount==255 ? " (saturated)" : "");
+}
+
+//------------------------------------PARTICLES--------------------------------------------------------
+
+/* Sparks for collisions and falls, simulated entirely on the GPU. The particle state lives in two
+   buffers: each frame ParticleUpdate_GL.vert reads one and transform feedback writes the next
+   state into the other, with rasterization off, then the points are drawn from the fresh one. A
+   burst only claims the next BURST_PARTICLES slots of the ring through uniforms, so the CPU never
+   touches a single particle. */
+#define MAX_PARTICLES 65536
+#define BURST_PARTICLES 8192
+#define MAX_BURSTS 4			// per frame, as in ParticleUpdate_GL.vert
+#define PARTICLE_SIZE 0.03f		// world units
+#define PARTICLE_MAX_LIFE 1.5f	// seconds
+
+struct ParticleBurst {
+	glm::vec3 origin, color;
+};
+
+struct ParticleSystem {
+	GLuint updateProgram;
+	GLint burstsID, burstOriginID, burstColorID, burstFirstID, deltaTimeID, seedID, pointSizeID;
+	GLuint buffers[2];
+	int current;				// buffer holding the latest state
+	int nextParticle;			// first slot of the next burst
+	ParticleBurst pending[MAX_BURSTS];
+	int numPending;
+	double lastUpdate;
+	double aliveUntil;			// no particle lives past this - nothing to update or draw after it
+} Particles;
+
+int particleEffects = ON;
+
+void initParticles ()
+{
+	const char* varyings[] = { "position", "velocity", "color" };
+	Particles.updateProgram = LoadShaders( "ParticleUpdate_GL.vert", "ParticleUpdate_GL.frag", varyings, 3 );
+	Particles.burstsID = glGetUniformLocation(Particles.updateProgram, "Bursts");
+	Particles.burstOriginID = glGetUniformLocation(Particles.updateProgram, "BurstOrigin");
+	Particles.burstColorID = glGetUniformLocation(Particles.updateProgram, "BurstColor");
+	Particles.burstFirstID = glGetUniformLocation(Particles.updateProgram, "BurstFirst");
+	Particles.deltaTimeID = glGetUniformLocation(Particles.updateProgram, "DeltaTime");
+	Particles.seedID = glGetUniformLocation(Particles.updateProgram, "Seed");
+	Particles.pointSizeID = glGetUniformLocation(particleProgramID, "PointSize");
+	useProgram(Particles.updateProgram);
+	glUniform1i(glGetUniformLocation(Particles.updateProgram, "BurstSize"), BURST_PARTICLES);
+	glUniform1i(glGetUniformLocation(Particles.updateProgram, "NumParticles"), MAX_PARTICLES);
+
+	// all particles start dead: a zero lifetime
+	vector<GLfloat> dead(MAX_PARTICLES*12, 0.0f);
+	for(int b=0; b<2; b++)
+	{
+		VAO* vao = createPulledObject(GL_POINTS, MAX_PARTICLES, 0);
+		glGenBuffers(1, &(vao->VertexBuffer));
+		frameStats.buffersCreated++;
+		frameStats.vertexBytes += dead.size()*sizeof(GLfloat);
+		bindVertexArray(vao->VertexArrayID);
+		glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, dead.size()*sizeof(GLfloat), &dead[0], GL_DYNAMIC_COPY);
+		for(int a=0; a<3; a++)
+		{
+			glEnableVertexAttribArray(a);
+			glVertexAttribPointer(a, 4, GL_FLOAT, GL_FALSE, 12*sizeof(GLfloat), (void*)(a*4*sizeof(GLfloat)));
+		}
+		Particles.buffers[b] = vao->VertexBuffer;
+		Meshes.particles[b] = registerMesh(vao);
+	}
+	bindVertexArray(0);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+
+	Particles.current = 0;
+	Particles.nextParticle = 0;
+	Particles.numPending = 0;
+	Particles.aliveUntil = 0;
+}
+
+/* Start a burst at origin with the next update - safe to call from input callbacks */
+void emitParticles (glm::vec3 origin, glm::vec3 color)
+{
+	if(particleEffects==OFF || Particles.numPending==MAX_BURSTS)
+		return;
+	ParticleBurst burst = { origin, color };
+	Particles.pending[Particles.numPending++] = burst;
+}
+
+/* Step every particle and queue the points, while any can be alive */
+void updateParticles ()
+{
+	double now = glfwGetTime();
+	float dt = min(now-Particles.lastUpdate, 0.05);		// a long stall should not throw particles across the board
+	Particles.lastUpdate = now;
+	if(Particles.numPending>0)
+		Particles.aliveUntil = now+PARTICLE_MAX_LIFE;
+	if(now>Particles.aliveUntil)
+		return;
+
+	GLfloat origins[3*MAX_BURSTS], colors[3*MAX_BURSTS];
+	GLint firsts[MAX_BURSTS];
+	for(int b=0; b<Particles.numPending; b++)
+	{
+		memcpy(origins+3*b, &Particles.pending[b].origin[0], 3*sizeof(GLfloat));
+		memcpy(colors+3*b, &Particles.pending[b].color[0], 3*sizeof(GLfloat));
+		firsts[b] = Particles.nextParticle;
+		Particles.nextParticle = (Particles.nextParticle+BURST_PARTICLES) % MAX_PARTICLES;
+	}
+
+	gpuTimestamp(PHASE_PARTICLES);
+	useProgram(Particles.updateProgram);
+	glUniform1i(Particles.burstsID, Particles.numPending);
+	if(Particles.numPending>0)
+	{
+		glUniform3fv(Particles.burstOriginID, Particles.numPending, origins);
+		glUniform3fv(Particles.burstColorID, Particles.numPending, colors);
+		glUniform1iv(Particles.burstFirstID, Particles.numPending, firsts);
+	}
+	glUniform1f(Particles.deltaTimeID, dt);
+	glUniform1ui(Particles.seedID, frameStats.frame);
+	Particles.numPending = 0;
+
+	int next = 1-Particles.current;
+	bindVertexArray(getMesh(Meshes.particles[Particles.current])->VertexArrayID);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, Particles.buffers[next]);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, MAX_PARTICLES);
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	frameStats.drawCalls++;
+	Particles.current = next;
+
+	// a particle of PARTICLE_SIZE seen at w 1, on the viewport of one view
+	useProgram(particleProgramID);
+	glUniform1f(Particles.pointSizeID, PARTICLE_SIZE*Matrices.projection[1][1]*renderHeight/(numViews>1 ? 4 : 2));
+	frameStats.uniformUpdates++;
+	drawWorldSpace(Meshes.particles[Particles.current], particleProgramID);
+	frameDirty = ON;			// keep drawing in on-demand mode while they fly
+}
+
+//------------------------------------KEYBOARD AND MOUSE FUNCTIONS--------------------------------------------
+void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    frameDirty = ON;
+    Point before = player;
+    int scoreBefore = score;
+     // Function is called first on GLFW_PRESS.
+    
+	
+    if (action == GLFW_PRESS) {
+        switch (key) {
+            case GLFW_KEY_RIGHT:
+            	keyboardCount++;
+            	if(adventureView==ON)
+            	{
+            		if(axis==4)
+            			axis=1;
+            		else if(axis==1)
+            			axis=3;
+            		else if(axis==3)
+            			axis=2;
+            		else if(axis==2)
+            			axis=4;
+            	}
+            	else
+            	{
+            		if((int)(2*(player.x+1)+3*player.z +randVal )% modVal != 0 && player.x+1<5)
+            		{	
+            			countSteps++;
+            			player.x+=1;
+            		}
+            		else
+            		{
+            			player.x=-5;
+            			player.z=5;
+            			score-=5;
+            		}
+            		axis=4;
+            	}
+
+            	break;
+            case GLFW_KEY_LEFT:
+            	keyboardCount++;
+            	if(adventureView==ON)
+            	{
+            		if(axis==4)
+            			axis=2;
+            		else if(axis==2)
+            			axis=3;
+            		else if(axis==3)
+            			axis=1;
+            		else if(axis==1)
+            			axis=4;
+            	}
+            	else
+            	{
+            		if((int)(2*(player.x-1)+3*player.z +randVal)% modVal != 0 && player.x-1>=-5)
+            		{
+            			countSteps++;
+            			player.x-=1;
+            		}
+            		else
+            		{
+            			player.x=-5;
+            			player.z=5;
+            			score-=5;
+            		}
+            		axis=4;
+            	}
+            	break;
+            case GLFW_KEY_UP:
+            	keyboardCount++;
+            	if(adventureView==ON)
+            	{
+           			switch(axis)
+           			{
+           				case 4: 
+           					if((int)(2*player.x+3*(player.z-1) +randVal)% modVal != 0 && player.z-1>=-4)
+           					{
+           						countSteps++;
+            					player.z-=1;
+           					}
+           					else
+            				{
+            					player.x=-5;
+            					player.z=5;
+            					score-=5;
+            				}
+                			break;
+                		case 3:
+                			if((int)(2*player.x+3*(player.z+1) +randVal)% modVal != 0 && player.z+1<=5)
+                			{
+                				countSteps++;
+            					player.z+=1;
+                			}
+                			else
+            				{
+            					player.x=-5;
+            					player.z=5;
+            					score-=5;
+            				}
+                			break;
+                		case 2:
+                			if((int)(2*(player.x-1)+3*(player.z) +randVal)% modVal != 0 && player.x-1>=-5)
+                			{
+                				countSteps++;
+                				player.x-=1;
+                			}
+                			else
+            				{
+            					player.x=-5;
+            					player.z=5;
+            					score-=5;
+            				}
+                			break;
+                		case 1:
+                			if((int)(2*(player.x+1)+3*(player.z) +randVal)% modVal != 0 && player.x+1<=4)
+                			{
+                				countSteps++;
+            					player.x+=1;
+                			}
+                			else
+            				{
+            					player.x=-5;
+            					player.z=5;
+            					score-=5;
+            				}
+                			break;
+           			}
+           		}
+           		else
            		{
            			if((int)(2*player.x+3*(player.z-1) +randVal)% modVal != 0 && player.z-1>=-4)
            			{
@@ -464,473 +2039,1439 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
             			score-=5;
             		}
 
-            		axis=4;
-           		}
-           		break;
+            		axis=4;
+           		}
+           		break;
+
+           	case GLFW_KEY_5:
+           		helicopterView=ON;
+           		towerView=OFF;
+            	topView=OFF;
+            	adventureView=OFF;
+            	followcamView=OFF;
+            	eyePos.x=4;
+            	eyePos.y=3;
+            	eyePos.z=6;
+            	break;
+
+            case GLFW_KEY_3:
+            	towerView=ON;
+            	topView=OFF;
+            	adventureView=OFF;
+            	followcamView=OFF;
+            	helicopterView=OFF;
+            	break;
+           	case GLFW_KEY_4:
+           		towerView=OFF;
+            	topView=ON;
+            	adventureView=OFF;
+            	followcamView=OFF;
+            	helicopterView=OFF;
+            	break;
+            case GLFW_KEY_1:
+            	towerView=OFF;
+            	topView=OFF;
+            	adventureView=ON;
+            	followcamView=OFF;
+            	helicopterView=OFF;
+            	break;
+             case GLFW_KEY_2:
+            	towerView=OFF;
+            	topView=OFF;
+            	adventureView=OFF;
+            	followcamView=ON;
+            	helicopterView=OFF;
+            	break;
+            case GLFW_KEY_ESCAPE:
+                quit(window);
+                break;
+            case GLFW_KEY_SPACE:
+            	jump=ON;
+            	break;
+            default:
+                break;
+        }
+    }
+
+    if (score < scoreBefore)        // ran into an obstacle and got sent back
+        emitParticles(glm::vec3(before.x+0.5f, before.y+0.5f, before.z-0.5f), glm::vec3(0.2f, 0.91f, 1.0f));
+}
+
+/* Executed for character input (like in text boxes) */
+void keyboardChar (GLFWwindow* window, unsigned int key)
+{
+    frameDirty = ON;
+    switch (key) {
+        case 'Q':
+        case 'q':
+            quit(window);
+            break;
+        case 'L':
+        case 'l':
+            landMode = (LandMode)((landMode+1) % LAND_MODES);
+            break;
+        case 'V':
+        case 'v':
+            splitScreen = !splitScreen;
+            break;
+        case 'H':
+        case 'h':
+            showHud = !showHud;
+            break;
+        case 'O':
+        case 'o':
+            overdrawView = !overdrawView;
+            break;
+        default:
+            break;
+    }
+}
+
+/* Executed when a mouse button is pressed/released */
+void mouseButton (GLFWwindow* window, int button, int action, int mods)
+{
+    frameDirty = ON;
+    switch (button) {
+        case GLFW_MOUSE_BUTTON_LEFT:
+            if (action == GLFW_PRESS){
+            	diffX=mouseX-prevMouseX;
+            	diffY=mouseY-prevMouseY;
+            	if(mouseY>0)
+            		diffY=-1;
+            	else
+            		diffY=+1;
+            	if(mouseX>0)
+            		diffX=-1;
+            	else
+            		diffX=+1;
+           	 	upPos.x=0; upPos.y=1; upPos.z=0;
+				eyePos.x+=diffX;
+				eyePos.z+=diffY;
+				eyePos.y=5;
+				targetPos.x=eyePos.x;
+				targetPos.y=eyePos.y;
+				targetPos.z=eyePos.z-10;
+				camAngle=90.0f;
+            	prevMouseX=mouseX; prevMouseY=mouseY;
+
+            }
+
+            break;
+        case GLFW_MOUSE_BUTTON_RIGHT:
+            if (action == GLFW_RELEASE) {
+
+            }
+            break;
+        default:
+            break;
+    }
+}
+void checkMouseCoordinates(GLFWwindow* window, double x , double y){
+    mouseX=(float)x-(float)windowWidth/2;		//Getting pixels into coordinates
+    mouseY=(float)windowHeight/2-(float)y;
+
+    //cout<<mouseX<<" "<<mouseY<<"\n";
+}
+//---------------------------------------------------------------
+
+void reshapeWindow (GLFWwindow* window, int width, int height)
+{
+    int fbwidth=width, fbheight=height;
+    frameDirty = ON;
+    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    framebufferWidth=fbwidth;
+    framebufferHeight=fbheight;
+    resizeRenderTarget(fbwidth, fbheight);
+    glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+    //float x=12.0f;
+    //Matrices.projection = glm::ortho(-x, x, -x, x, 0.10f, 400.0f);
+    Matrices.projection = glm::perspective(camAngle, (GLfloat)fbwidth/(GLfloat)fbheight, 0.1f, 500.0f);
+
+}
+
+/* Nothing is drawn while the window is minimized, and while it is unfocused only when the frame
+   is dirty - the picture only changes on input anyway */
+void windowIconify (GLFWwindow* window, int iconified)
+{
+    windowIconified = iconified ? ON : OFF;
+    frameDirty = ON;
+}
+
+void windowFocus (GLFWwindow* window, int focused)
+{
+    windowFocused = focused ? ON : OFF;
+    frameDirty = ON;
+}
+
+/* The window system lost the contents of the window, e.g. after it was uncovered */
+void windowRefresh (GLFWwindow* window)
+{
+    frameDirty = ON;
+}
+
+
+GLFWwindow* initGLFW (int width, int height)
+{
+    GLFWwindow* window; // window desciptor/handle
+
+    glfwSetErrorCallback(error_callback);
+    if (!glfwInit()) {
+        exit(EXIT_FAILURE);
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    window = glfwCreateWindow(width, height, "Sample OpenGL 3.3 Application", NULL, NULL);
+
+    if (!window) {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+
+    glfwMakeContextCurrent(window);
+    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+    glfwSwapInterval( 1 );
+    glfwSetFramebufferSizeCallback(window, reshapeWindow);
+    glfwSetWindowSizeCallback(window, reshapeWindow);
+    glfwSetWindowCloseCallback(window, quit);
+    glfwSetKeyCallback(window, keyboard);      // general keyboard input
+    glfwSetCharCallback(window, keyboardChar);  // simpler specific character handling
+    glfwSetMouseButtonCallback(window, mouseButton);  // mouse button clicks
+    glfwSetCursorPosCallback(window, checkMouseCoordinates);
+    glfwSetWindowIconifyCallback(window, windowIconify);
+    glfwSetWindowFocusCallback(window, windowFocus);
+    glfwSetWindowRefreshCallback(window, windowRefresh);
+    return window;
+}
+
+void initGL (GLFWwindow* window, int width, int height)
+{
+	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	instancedProgramID = LoadShaders( "Instanced_GL.vert", "Sample_GL.frag" );
+	instancedVPID = glGetUniformLocation(instancedProgramID, "VP");
+	boardProgramID = LoadShaders( "Board_GL.vert", "Board_GL.frag" );
+	boardVPID = glGetUniformLocation(boardProgramID, "VP");
+	pulledProgramID = LoadShaders( "Pulled_GL.vert", "Sample_GL.frag" );
+	pulledVPID = glGetUniformLocation(pulledProgramID, "VP");
+	particleProgramID = LoadShaders( "Particle_GL.vert", "Sample_GL.frag" );
+	particleVPID = glGetUniformLocation(particleProgramID, "VP");
+	initStreamBuffer();
+	initTransformBuffer();
+	initGpuTimers();
+	initHud();
+	initRenderTarget();
+	createMeshes();
+	initParticles();
+	reshapeWindow (window, width, height);
+	glClearDepth (1.0f);
+	glEnable (GL_DEPTH_TEST);
+	glDepthFunc (GL_LEQUAL);
+
+}
+ 
+/* Geometry of a tile face - the tile meshes are assembled from it */
+static constexpr GLfloat tileSideVertices [] = {
+    0,0,0,     1,0,0,     0,-2,0,
+    1,0,0,     1,-2,0,    0,-2,0, 
+};
+static constexpr GLfloat tileFrontColors [] = {
+    1,0,0,     1,0,0,     1,0,0, 
+    1,0,0,     1,0,0,     1,0,0,     };
+static constexpr GLfloat tileSideColors [] = {
+    0,0,1,     0,0,1,    0,0,1,
+    0,0,1,     0,0,1,     0,0,1,     };
+static constexpr GLfloat tileTopVertices [] = {
+    0, 0, 0,    0, 1, 0,    1, 0, 0,
+    0, 1, 0,    1, 0, 0,    1, 1, 0
+};
+static constexpr GLfloat tileTopColors [] = {
+    1,0,0,     1,1,1,     1,1,1, 
+    1,1,1,     1,1,1,     1,0,0,
+};
+static constexpr GLfloat tileTopObstacleColors [] = {
+    0.35,0.45,0.41,     1,1,1,     1,1,1, 
+    1,1,1,     1,1,1,    0.35,0.45,0.41   };
+
+/* Spike of an obstacle - one triangle */
+static constexpr GLfloat spikeVertices [] = {
+    0, 0, 0,    0.5, 1.5, 0,    1, 0, 0, };
+static constexpr GLfloat spikeColors [] = {
+    0.2,0.91,1.0,    0.6,0.23,0.56,     0.2,0.91,1.0 };
+
+/* Faces of the player cube - a unit quad in the xy plane */
+static constexpr GLfloat playerSideVertices [] = {
+    0,0,0,     1,0,0,     0,1,0,     1,0,0,
+    1,1,0,    0,1,0,     };
+static constexpr GLfloat playerFrontColors [] = {
+    0,0.39,0,     0,0.39,0,    0,0.39, 0,
+    0,0.39,0,    0,0.39,0,     0,0.39, 0,    };
+static constexpr GLfloat playerSideColors [] = {
+    0,1,0,     0,1,0,     0,1,0, 
+    0,1,0,     0,1,0,     0,1,0,     };
+static constexpr GLfloat playerTopColors [] = {
+    0,1,0,     0,0,0,     0,1,0, 
+    0,0,0,     0,1,0,     0,1,0, 	};
+
+//------------------------------------GEOMETRY TABLES--------------------------------------------------------
+
+/* The static meshes are oriented at compile time from the face data above. Faces are only ever
+   turned by right angles or 45 degrees, so rotations take their exact cosine and sine instead of
+   an angle and no trig is involved. --verify-tables compares the tables against glm. */
+#define COS45 0.70710678f
+
+struct Affine {
+	float m[3][4];		// rows of a 3x4 matrix: x' = m[0][0]*x + m[0][1]*y + m[0][2]*z + m[0][3]
+};
+
+constexpr Affine identity3D ()
+{
+	return Affine{{ {1,0,0,0}, {0,1,0,0}, {0,0,1,0} }};
+}
+constexpr Affine translation (float x, float y, float z)
+{
+	return Affine{{ {1,0,0,x}, {0,1,0,y}, {0,0,1,z} }};
+}
+constexpr Affine rotationX (float c, float s)
+{
+	return Affine{{ {1,0,0,0}, {0,c,-s,0}, {0,s,c,0} }};
+}
+constexpr Affine rotationY (float c, float s)
+{
+	return Affine{{ {c,0,s,0}, {0,1,0,0}, {-s,0,c,0} }};
+}
+constexpr Affine operator* (const Affine& a, const Affine& b)
+{
+	Affine r = identity3D();
+	for(int i=0; i<3; i++)
+		for(int j=0; j<4; j++)
+			r.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j] + (j==3 ? a.m[i][3] : 0.0f);
+	return r;
+}
+
+template<int N>
+struct MeshTable {
+	GLfloat pos[3*N];
+	GLfloat col[3*N];
+	enum { vertices = N };
+};
+
+/* Write numVertices vertices placed by face into t, starting at vertex at */
+template<int N>
+constexpr void appendFace (MeshTable<N>& t, int& at, const GLfloat* vertices, const GLfloat* colors, int numVertices, const Affine& face)
+{
+	for(int v=0; v<numVertices; v++, at++)
+		for(int k=0; k<3; k++)
+		{
+			t.pos[3*at+k] = face.m[k][0]*vertices[3*v] + face.m[k][1]*vertices[3*v+1] + face.m[k][2]*vertices[3*v+2] + face.m[k][3];
+			t.col[3*at+k] = colors[3*v+k];
+		}
+}
+
+/* Tile prism: front, left, right and back sides, then the top */
+constexpr MeshTable<30> tileTable (const GLfloat* topColors)
+{
+	MeshTable<30> t = {};
+	int at = 0;
+	appendFace(t, at, tileSideVertices, tileFrontColors, 6, identity3D());
+	appendFace(t, at, tileSideVertices, tileSideColors, 6, rotationY(0,1));
+	appendFace(t, at, tileSideVertices, tileSideColors, 6, translation(1,0,0)*rotationY(0,1));
+	appendFace(t, at, tileSideVertices, tileFrontColors, 6, translation(0,0,-1));
+	appendFace(t, at, tileTopVertices, topColors, 6, rotationX(0,-1));
+	return t;
+}
+
+/* Both spike pyramids of an obstacle - the lower one is the upper one mirrored through the x axis */
+constexpr MeshTable<24> spikeTable ()
+{
+	MeshTable<24> t = {};
+	int at = 0;
+	Affine flip = rotationX(-1,0);
+	// upper half: front, left, right, back
+	appendFace(t, at, spikeVertices, spikeColors, 3, rotationX(COS45,-COS45));
+	appendFace(t, at, spikeVertices, spikeColors, 3, rotationY(0,1)*rotationX(COS45,COS45));
+	appendFace(t, at, spikeVertices, spikeColors, 3, translation(1,0,0)*rotationY(0,1)*rotationX(COS45,-COS45));
+	appendFace(t, at, spikeVertices, spikeColors, 3, translation(0,0,-1)*rotationX(COS45,COS45));
+	// lower half
+	appendFace(t, at, spikeVertices, spikeColors, 3, flip*translation(0,0,1)*rotationX(COS45,-COS45));
+	appendFace(t, at, spikeVertices, spikeColors, 3, flip*translation(0,0,1)*rotationY(0,1)*rotationX(COS45,COS45));
+	appendFace(t, at, spikeVertices, spikeColors, 3, flip*translation(1,0,1)*rotationY(0,1)*rotationX(COS45,-COS45));
+	appendFace(t, at, spikeVertices, spikeColors, 3, flip*rotationX(COS45,COS45));
+	return t;
+}
+
+/* Player cube relative to the player position: front, left, right, back, top */
+constexpr MeshTable<30> playerTable ()
+{
+	MeshTable<30> t = {};
+	int at = 0;
+	appendFace(t, at, playerSideVertices, playerFrontColors, 6, identity3D());
+	appendFace(t, at, playerSideVertices, playerSideColors, 6, rotationY(0,1));
+	appendFace(t, at, playerSideVertices, playerSideColors, 6, translation(1,0,0)*rotationY(0,1));
+	appendFace(t, at, playerSideVertices, playerFrontColors, 6, translation(0,0,-1));
+	appendFace(t, at, tileTopVertices, playerTopColors, 6, translation(0,1,0)*rotationX(0,-1));
+	return t;
+}
+
+constexpr MeshTable<30> tileMesh = tileTable(tileTopColors);
+constexpr MeshTable<30> tileObstacleMesh = tileTable(tileTopObstacleColors);
+constexpr MeshTable<24> spikeMesh = spikeTable();
+constexpr MeshTable<30> playerMesh = playerTable();
+
+//----------------------------------------------------------------------------------------------------------
 
-           	case GLFW_KEY_5:
-           		cout<<"helicopterView!\n";
-           		helicopterView=ON;
-           		towerView=OFF;
-            	topView=OFF;
-            	adventureView=OFF;
-            	followcamView=OFF;
-            	eyePos.x=4;
-            	eyePos.y=3;
-            	eyePos.z=6;
-            	break;
+/* Mesh data kept on the CPU side so larger meshes can be assembled from it */
+struct Geometry {
+	vector<GLfloat> pos, col;
+	vector<GLfloat> altCol;		// colors in the alternate state, if any
+	vector<GLuint> indices;		// set by weldGeometry()
+};
+Geometry tileGeometry, obstacleGeometry, playerGeometry;
 
-            case GLFW_KEY_3:
-            	towerView=ON;
-            	topView=OFF;
-            	adventureView=OFF;
-            	followcamView=OFF;
-            	helicopterView=OFF;
-            	break;
-           	case GLFW_KEY_4:
-           		towerView=OFF;
-            	topView=ON;
-            	adventureView=OFF;
-            	followcamView=OFF;
-            	helicopterView=OFF;
-            	break;
-            case GLFW_KEY_1:
-            	towerView=OFF;
-            	topView=OFF;
-            	adventureView=ON;
-            	followcamView=OFF;
-            	helicopterView=OFF;
-            	break;
-             case GLFW_KEY_2:
-            	towerView=OFF;
-            	topView=OFF;
-            	adventureView=OFF;
-            	followcamView=ON;
-            	helicopterView=OFF;
-            	break;
-            case GLFW_KEY_ESCAPE:
-                quit(window);
-                break;
-            case GLFW_KEY_SPACE:
-            	jump=ON;
-            	break;
-            default:
-                break;
-        }
-    }
+/* Append vertices transformed by model, snapping results that land (almost) on the 1/1024 grid back onto it */
+void appendTransformed (vector<GLfloat>& pos, vector<GLfloat>& col, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, glm::mat4 model)
+{
+	for(int v=0; v<numVertices; v++)
+	{
+		glm::vec4 p = model*glm::vec4(vertex_buffer_data[3*v], vertex_buffer_data[3*v+1], vertex_buffer_data[3*v+2], 1);
+		for(int k=0; k<3; k++)
+		{
+			GLfloat snapped = floorf(p[k]*1024.0f+0.5f)/1024.0f;
+			pos.push_back(fabsf(p[k]-snapped)<1e-4f ? snapped : p[k]);
+			col.push_back(color_buffer_data[3*v+k]);
+		}
+	}
+}
+
+/* Merge the vertices that agree in position and every color, turning the triangle list into
+   an indexed mesh - faces meeting at an edge with the same colors share their corners */
+void weldGeometry (Geometry& g)
+{
+	int n = g.pos.size()/3, stride = g.altCol.empty() ? 6 : 9;
+	vector<GLfloat> pos, col, altCol;
+	g.indices.clear();
+
+	for(int v=0; v<n; v++)
+	{
+		GLfloat key[9];
+		for(int k=0; k<3; k++)
+		{
+			key[k] = g.pos[3*v+k];
+			key[3+k] = g.col[3*v+k];
+			if(stride==9)
+				key[6+k] = g.altCol[3*v+k];
+		}
 
+		int found = -1;
+		for(int w=0; w<(int)pos.size()/3 && found<0; w++)
+		{
+			GLfloat other[9];
+			for(int k=0; k<3; k++)
+			{
+				other[k] = pos[3*w+k];
+				other[3+k] = col[3*w+k];
+				if(stride==9)
+					other[6+k] = altCol[3*w+k];
+			}
+			if(memcmp(key, other, stride*sizeof(GLfloat))==0)
+				found = w;
+		}
+		if(found<0)
+		{
+			found = pos.size()/3;
+			pos.insert(pos.end(), key, key+3);
+			col.insert(col.end(), key+3, key+6);
+			if(stride==9)
+				altCol.insert(altCol.end(), key+6, key+9);
+		}
+		g.indices.push_back(found);
+	}
+	g.pos.swap(pos);
+	g.col.swap(col);
+	g.altCol.swap(altCol);
 }
 
-/* Executed for character input (like in text boxes) */
-void keyboardChar (GLFWwindow* window, unsigned int key)
+/* Indexed mesh of a welded geometry, drawn with the given per vertex colors */
+VAO* indexedObject (const Geometry& g, const vector<GLfloat>& colors)
 {
-    switch (key) {
-        case 'Q':
-        case 'q':
-            quit(window);
-            break;
-        default:
-            break;
-    }
+	VAO* mesh = create3DObject(GL_TRIANGLES, g.pos.size()/3, &g.pos[0], &colors[0], GL_FILL);
+	setIndices(mesh, g.indices);
+	return mesh;
 }
 
-/* Executed when a mouse button is pressed/released */
-void mouseButton (GLFWwindow* window, int button, int action, int mods)
+/* Copy a compile time table into g - alternate colors from alt, if given */
+template<int N>
+void tableGeometry (Geometry& g, const MeshTable<N>& t, const MeshTable<N>* alt=NULL)
 {
-    switch (button) {
-        case GLFW_MOUSE_BUTTON_LEFT:
-            if (action == GLFW_PRESS){
-            	cout<<mouseX-prevMouseX<<" "<<mouseY-prevMouseY<<"\n";
-            	diffX=mouseX-prevMouseX;
-            	diffY=mouseY-prevMouseY;
-            	if(mouseY>0)
-            		diffY=-1;
-            	else
-            		diffY=+1;
-            	if(mouseX>0)
-            		diffX=-1;
-            	else
-            		diffX=+1;
-           	 	upPos.x=0; upPos.y=1; upPos.z=0;
-				eyePos.x+=diffX;
-				eyePos.z+=diffY;
-				eyePos.y=5;
-				targetPos.x=eyePos.x;
-				targetPos.y=eyePos.y;
-				targetPos.z=eyePos.z-10;
-				camAngle=90.0f;
-            	prevMouseX=mouseX; prevMouseY=mouseY;
+	g.pos.assign(t.pos, t.pos+3*N);
+	g.col.assign(t.col, t.col+3*N);
+	if(alt!=NULL)
+		g.altCol.assign(alt->col, alt->col+3*N);
+	weldGeometry(g);
+}
 
-            }
+/* The tile prism; the alternate colors are the ones of a tile carrying an obstacle */
+void buildTileGeometry (Geometry& tile)
+{
+	tableGeometry(tile, tileMesh, &tileObstacleMesh);
+}
 
-            break;
-        case GLFW_MOUSE_BUTTON_RIGHT:
-            if (action == GLFW_RELEASE) {
+VAO* TileInstanceMesh()
+{
+	VAO* tile = indexedObject(tileGeometry, tileGeometry.col);
+	attachAltColors(tile, &tileGeometry.altCol[0]);
+	return tile;
+}
+/* The eight spike faces of an obstacle merged in obstacle space - drawing it at translate(i, up, j)
+   gives what the eight separate faces used to */
+void buildObstacleGeometry (Geometry& spikes)
+{
+	tableGeometry(spikes, spikeMesh);
+}
 
-            }
-            break;
-        default:
-            break;
+VAO* obstacle()
+{
+	return indexedObject(obstacleGeometry, obstacleGeometry.col);
+}
+void drawObstacle(int i, int up, int j)
+{
+	addToBatch(landBatch, Meshes.obstacle, i, up, j);
+}
+
+VAO* Axis(int which)
+{
+	static const GLfloat X [] = {
+		10, 0, 0,		-10, 0, 0,
+	};
+	static const GLfloat Y [] = {
+		0, 10, 0,		0, -10, 0
+	};
+	static const GLfloat Z [] = {
+		0, 0, 10,		0, 0, -10
+	};
+	static const GLfloat colX [] = {
+		1, 1, 1,		1, 1, 1
+	};
+	static const GLfloat colY [] = {
+		0, 1, 0,		0, 1, 0
+	};
+	static const GLfloat colZ [] = {
+		1, 0, 0,		1, 0, 0
+	};
+	if(which==0)
+		return create3DObject(GL_LINE_STRIP,2, X, colX, GL_FILL);
+	if(which==1)
+		return create3DObject(GL_LINE_STRIP,2, Y, colY, GL_FILL);
+	return create3DObject(GL_LINE_STRIP,2, Z, colZ, GL_FILL);
+}
+void drawAxis()
+{
+	Matrices.model=glm::mat4(1.0f);
+	drawModel(Meshes.axisX, Matrices.model);
+	drawModel(Meshes.axisY, Matrices.model);
+	drawModel(Meshes.axisZ, Matrices.model);
+}
+//------------------------------------FRUSTUM CULLING--------------------------------------------------------
+
+/* Tiles, obstacles and baked chunks are tested against the planes of the frame's VP and skipped
+   (no transform, no draw item) when their box lies completely outside one of them - in split
+   screen, outside one of them for every view */
+struct Bounds {
+	glm::vec3 min, max;
+};
+
+struct Frustum {
+	glm::vec4 planes[6];		// inside where dot(plane.xyz, p) + plane.w >= 0
+} viewFrusta[MAX_VIEWS];
+
+int frustumCulling = ON;
+Bounds tileBounds, obstacleBounds;		// in tile / obstacle space
+
+/* Planes of the clip volume -w <= x, y, z <= w expressed in world space */
+Frustum frustumFromVP (const glm::mat4& vp)
+{
+	Frustum f;
+	glm::vec4 row[4];
+	for(int r=0; r<4; r++)
+		row[r] = glm::vec4(vp[0][r], vp[1][r], vp[2][r], vp[3][r]);
+	for(int axis=0; axis<3; axis++)
+	{
+		f.planes[2*axis] = row[3]+row[axis];
+		f.planes[2*axis+1] = row[3]-row[axis];
+	}
+	return f;
+}
+
+Bounds geometryBounds (const Geometry& g)
+{
+	Bounds b = { glm::vec3(1e9f), glm::vec3(-1e9f) };
+	for(size_t v=0; v+2<g.pos.size(); v+=3)
+		for(int k=0; k<3; k++)
+		{
+			b.min[k] = min(b.min[k], g.pos[v+k]);
+			b.max[k] = max(b.max[k], g.pos[v+k]);
+		}
+	return b;
+}
+
+/* Whether the box b moved by offset can be seen - counted in the frame stats */
+int isVisible (const Bounds& b, const glm::vec3& offset)
+{
+	if(frustumCulling==OFF)
+		return ON;
+	frameStats.cullTested++;
+	for(int v=0; v<numViews; v++)
+	{
+		int inside = ON;
+		for(int p=0; p<6 && inside==ON; p++)
+		{
+			const glm::vec4& plane = viewFrusta[v].planes[p];
+			glm::vec3 farthest(plane.x>0 ? b.max.x : b.min.x, plane.y>0 ? b.max.y : b.min.y, plane.z>0 ? b.max.z : b.min.z);
+			farthest+=offset;
+			if(plane.x*farthest.x + plane.y*farthest.y + plane.z*farthest.z + plane.w < 0)
+				inside = OFF;
+		}
+		if(inside==ON)
+			return ON;
+	}
+	frameStats.culled++;
+	return OFF;
+}
+
+//----------------------------------------------------------------------------------------------------------
+
+void createLandLegacy()
+{
+    int up=0;
+	MeshHandle T= Meshes.tile;
+
+	for(int i=boardMinX; i<boardMaxX; i++)				//-5 to 5
+    {
+    	for(int j=boardMinZ; j<boardMaxZ; j++)				//-4 to 6
+    	{
+    		if((2*i+3*j + randVal)% modVal == 0)
+    		{
+    			up=0;
+    			if(isVisible(obstacleBounds, glm::vec3(i, 1, j)))
+    				drawObstacle(i, 1, j);
+    			T=Meshes.tileObstacle;
+    		}
+    		else
+    		{
+    			T=Meshes.tile;
+    			up=0;
+    		}
+    		if(player.x==i && player.z==j)
+    			up=0;
+    		if(i+j==randVal && randVal!=0)
+    			continue;
+
+    		//whole tile - four sides and the top - in one draw
+    		if(isVisible(tileBounds, glm::vec3(i, up, j)))
+    			addToBatch(landBatch, T, i, up, j);
+    	}
     }
+    drawBatch(landBatch);
+
 }
-void checkMouseCoordinates(GLFWwindow* window, double x , double y){
-    mouseX=(float)x-(float)windowWidth/2;		//Getting pixels into coordinates
-    mouseY=(float)windowHeight/2-(float)y;
 
-    //cout<<mouseX<<" "<<mouseY<<"\n";
+//------------------------------------LAYOUT TRANSITIONS--------------------------------------------------------
+
+/* When the layout changes, the instanced and pulled boards let tiles and spikes that come or go
+   rise into place or sink away, in a wave running from the first tile to the last; the vertex
+   shaders do the animation from the old and new layout and the time since the change.
+   createLand() records every change whatever the land mode, so switching boards mid-game never
+   replays an old one. The baked, meshed and legacy boards switch instantly (the meshed board's
+   spikes are instanced and do animate). */
+int shownLayout = -1;			// randVal createLand() last drew
+int previousLayout = -1;		// the layout before it, equal to shownLayout once there is nothing to animate
+int layoutChanges = 0;			// bumped whenever shownLayout or previousLayout changes
+float transitionSeconds = 0.6f;	// per tile, 0 switches layouts instantly
+double layoutChangeTime = 0;
+float layoutTime = 0;			// seconds since the change, while layoutTransition is ON
+int layoutTransition = OFF;		// tiles are still moving
+
+/* Fraction of the transition time by which the wave reaches tile i, j */
+float layoutWave (int i, int j)
+{
+	return float((i-boardMinX) + (j-boardMinZ)) / float(boardMaxX-boardMinX + boardMaxZ-boardMinZ);
+}
+
+/* Whether the tile at i, j, a hole in the new layout, is still sinking on screen - it carries the
+   player until it is gone */
+int tileSinking (int i, int j)
+{
+	if(transitionSeconds<=0 || (landMode!=LAND_INSTANCED && landMode!=LAND_PULLED))
+		return OFF;
+	if(randVal!=shownLayout)		// rerolled this frame, the change starts with the next one
+		return i+j==shownLayout && shownLayout!=0 ? OFF : ON;
+	if(layoutTransition==OFF || (i+j==previousLayout && previousLayout!=0))		// settled, or a hole before the change too
+		return OFF;
+	return layoutTime < (layoutWave(i, j)+1)*transitionSeconds ? ON : OFF;
+}
+
+/* The instanced board and the baked level are split into square chunks of tiles, which are
+   tested against the frustum as a whole */
+#define CHUNK_SIZE 5
+
+/* The instances of one chunk of the board, for the current layout */
+struct InstanceChunk {
+	Bounds bounds;						// of every tile and spike the chunk can hold, whatever the layout
+	vector<TileInstance> tiles, obstacles;
+};
+vector<InstanceChunk> instanceChunks;
+int instanceLayoutChanges = -1;			// layoutChanges instanceChunks were built for
+float instancedLayoutTime = -1;			// LayoutTime the instanced program was given
+
+/* What an instance buffer holds, so it is only rewritten when that changes */
+struct InstanceUpload {
+	int layoutChanges;
+	vector<char> visible;				// per chunk
+} tileUpload = { -1 }, obstacleUpload = { -1 };
+
+/* Instance state bits, read by Instanced_GL.vert */
+enum {
+	INSTANCE_ALT = 1,					// drawn with the alternate colors (a tile carrying an obstacle) ...
+	INSTANCE_WAS_ALT = 2,				// ... before the layout change
+	INSTANCE_PRESENT = 4,				// there in the new layout ...
+	INSTANCE_WAS_PRESENT = 8			// ... and in the old one
+};
+
+void initInstancedBoard ()
+{
+	useProgram(instancedProgramID);
+	glUniform2i(glGetUniformLocation(instancedProgramID, "BoardMin"), boardMinX, boardMinZ);
+	glUniform1i(glGetUniformLocation(instancedProgramID, "BoardWidth"), boardMaxX-boardMinX);
+	glUniform1i(glGetUniformLocation(instancedProgramID, "BoardDepth"), boardMaxZ-boardMinZ);
+	glUniform1f(glGetUniformLocation(instancedProgramID, "TransitionLength"), max(transitionSeconds, 0.001f));
+	instancedLayoutTimeID = glGetUniformLocation(instancedProgramID, "LayoutTime");
+}
+
+/* Sort the tiles and obstacles of the new and old layout into chunks - only runs when the layout
+   changes and when its transition ends */
+void buildLandInstances()
+{
+	if(instanceChunks.empty())
+	{
+		Bounds cell = { glm::min(tileBounds.min, obstacleBounds.min+glm::vec3(0, 1, 0)), glm::max(tileBounds.max, obstacleBounds.max+glm::vec3(0, 1, 0)) };
+		for(int x=boardMinX; x<boardMaxX; x+=CHUNK_SIZE)
+			for(int z=boardMinZ; z<boardMaxZ; z+=CHUNK_SIZE)
+			{
+				InstanceChunk chunk;
+				chunk.bounds.min = cell.min+glm::vec3(x, 0, z);
+				chunk.bounds.max = cell.max+glm::vec3(min(x+CHUNK_SIZE, boardMaxX)-1, 0, min(z+CHUNK_SIZE, boardMaxZ)-1);
+				instanceChunks.push_back(chunk);
+			}
+	}
+
+	int chunksZ = (boardMaxZ-boardMinZ+CHUNK_SIZE-1)/CHUNK_SIZE;
+	for(size_t c=0; c<instanceChunks.size(); c++)
+	{
+		instanceChunks[c].tiles.clear();
+		instanceChunks[c].obstacles.clear();
+	}
+	for(int i=boardMinX; i<boardMaxX; i++)
+	{
+		for(int j=boardMinZ; j<boardMaxZ; j++)
+		{
+			InstanceChunk& chunk = instanceChunks[(i-boardMinX)/CHUNK_SIZE*chunksZ + (j-boardMinZ)/CHUNK_SIZE];
+			int obstacle = (2*i+3*j + shownLayout)% modVal == 0, wasObstacle = (2*i+3*j + previousLayout)% modVal == 0;
+			int hole = i+j==shownLayout && shownLayout!=0, wasHole = i+j==previousLayout && previousLayout!=0;
+			if(obstacle || wasObstacle)
+			{
+				TileInstance spikes = { (GLshort)i, 1, (GLshort)j, (GLshort)((obstacle ? INSTANCE_PRESENT : 0) | (wasObstacle ? INSTANCE_WAS_PRESENT : 0)) };
+				chunk.obstacles.push_back(spikes);
+			}
+			if(hole && wasHole)
+				continue;
+			TileInstance tile = { (GLshort)i, 0, (GLshort)j, (GLshort)((obstacle ? INSTANCE_ALT : 0) | (wasObstacle ? INSTANCE_WAS_ALT : 0) | (hole ? 0 : INSTANCE_PRESENT) | (wasHole ? 0 : INSTANCE_WAS_PRESENT)) };
+			chunk.tiles.push_back(tile);
+		}
+	}
+	instanceLayoutChanges=layoutChanges;
+}
+
+/* Fill the instance buffer of mesh with the tiles or obstacles of the visible chunks, unless it
+   already holds exactly those */
+void uploadInstances (MeshHandle mesh, InstanceUpload& uploaded, const vector<char>& visible, int obstacles)
+{
+	if(uploaded.layoutChanges==instanceLayoutChanges && uploaded.visible==visible)
+		return;
+	static vector<TileInstance> instances;
+	instances.clear();
+	for(size_t c=0; c<instanceChunks.size(); c++)
+		if(visible[c])
+		{
+			const vector<TileInstance>& chunk = obstacles ? instanceChunks[c].obstacles : instanceChunks[c].tiles;
+			instances.insert(instances.end(), chunk.begin(), chunk.end());
+		}
+	setInstances(getMesh(mesh), instances);
+	uploaded.layoutChanges=instanceLayoutChanges;
+	uploaded.visible=visible;
+}
+
+/* Bring the instance buffers up to date with the layout and the visible chunks - the per frame
+   cost is one frustum test per chunk, and none at all with --no-cull */
+void updateLandInstances (int withTiles)
+{
+	if(instanceLayoutChanges!=layoutChanges)
+		buildLandInstances();
+	if(instancedLayoutTime!=layoutTime)
+	{
+		useProgram(instancedProgramID);
+		glUniform1f(instancedLayoutTimeID, layoutTime);
+		frameStats.uniformUpdates++;
+		instancedLayoutTime=layoutTime;
+	}
+
+	static vector<char> visible;
+	visible.resize(instanceChunks.size());
+	for(size_t c=0; c<instanceChunks.size(); c++)
+		visible[c] = isVisible(instanceChunks[c].bounds, glm::vec3(0));
+
+	if(withTiles==ON)
+		uploadInstances(Meshes.tileInstanced, tileUpload, visible, OFF);
+	uploadInstances(Meshes.obstacleInstanced, obstacleUpload, visible, ON);
+}
+
+/* Whole board in one instanced draw - per frame cost depends on the number of chunks, not tiles */
+void createLandInstanced()
+{
+	updateLandInstances(ON);
+
+	if(getMesh(Meshes.tileInstanced)->NumInstances>0)
+		drawInstanced(Meshes.tileInstanced);
+	if(getMesh(Meshes.obstacleInstanced)->NumInstances>0)
+		drawInstanced(Meshes.obstacleInstanced);
+}
+
+/* Append the indices of a mesh whose vertices start at base */
+void appendIndices (vector<GLuint>& indices, const vector<GLuint>& mesh, GLuint base)
+{
+	for(size_t i=0; i<mesh.size(); i++)
+		indices.push_back(base+mesh[i]);
+}
+
+/* The baked level is split into chunks of CHUNK_SIZE tiles, each its own mesh, so chunks out of
+   view can be culled */
+
+struct LevelChunk {
+	MeshHandle mesh;
+	int minX, maxX, minZ, maxZ;		// tiles [minX, maxX) x [minZ, maxZ)
+	Bounds bounds;					// of the baked vertices
+};
+vector<LevelChunk> levelChunks[LAYOUT_COUNT];		// one set per layout, all baked at start up
+
+void createLevelChunks(int layout)
+{
+	for(int x=boardMinX; x<boardMaxX; x+=CHUNK_SIZE)
+		for(int z=boardMinZ; z<boardMaxZ; z+=CHUNK_SIZE)
+		{
+			LevelChunk chunk;
+			chunk.mesh = registerMesh(create3DObject(GL_TRIANGLES, 0, NULL, (const GLfloat*)NULL, GL_FILL, VERTEX_FLOAT));
+			chunk.minX = x;
+			chunk.maxX = min(x+CHUNK_SIZE, boardMaxX);
+			chunk.minZ = z;
+			chunk.maxZ = min(z+CHUNK_SIZE, boardMaxZ);
+			levelChunks[layout].push_back(chunk);
+		}
+}
+
+/* Bake the tiles and obstacles of one chunk of layout into its mesh */
+void bakeChunk (LevelChunk& chunk, int layout)
+{
+	vector<GLfloat> pos, col;
+	vector<GLuint> indices;
+	int tileVertices = tileGeometry.pos.size()/3, obstacleVertices = obstacleGeometry.pos.size()/3;
+
+	for(int i=chunk.minX; i<chunk.maxX; i++)
+	{
+		for(int j=chunk.minZ; j<chunk.maxZ; j++)
+		{
+			int obstacle = (2*i+3*j + layout)% modVal == 0;
+			if(obstacle)
+			{
+				appendIndices(indices, obstacleGeometry.indices, pos.size()/3);
+				appendTransformed(pos, col, obstacleVertices, &obstacleGeometry.pos[0], &obstacleGeometry.col[0], glm::translate(glm::vec3(i, 1, j)));
+			}
+			if(i+j==layout && layout!=0)
+				continue;
+			appendIndices(indices, tileGeometry.indices, pos.size()/3);
+			appendTransformed(pos, col, tileVertices, &tileGeometry.pos[0], obstacle ? &tileGeometry.altCol[0] : &tileGeometry.col[0], glm::translate(glm::vec3(i, 0, j)));
+		}
+	}
+	update3DObject(getMesh(chunk.mesh), pos.size()/3, pos.empty() ? NULL : &pos[0], col.empty() ? NULL : &col[0]);
+	setIndices(getMesh(chunk.mesh), indices);
+	Geometry baked;
+	baked.pos.swap(pos);
+	chunk.bounds = geometryBounds(baked);
 }
-//---------------------------------------------------------------
 
-void reshapeWindow (GLFWwindow* window, int width, int height)
+/* Bake every tile and obstacle of layout into its level chunks; returns the GPU bytes used */
+int bakeLevel(int layout)
 {
-    int fbwidth=width, fbheight=height;
-    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
-    glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
-    //float x=12.0f;
-    //Matrices.projection = glm::ortho(-x, x, -x, x, 0.10f, 400.0f);
-    Matrices.projection = glm::perspective(camAngle, (GLfloat)fbwidth/(GLfloat)fbheight, 0.1f, 500.0f);
-
+	int bytes = 0;
+	createLevelChunks(layout);
+	for(size_t c=0; c<levelChunks[layout].size(); c++)
+	{
+		bakeChunk(levelChunks[layout][c], layout);
+		bytes += meshBytes(getMesh(levelChunks[layout][c].mesh));
+	}
+	return bytes;
 }
 
-
-GLFWwindow* initGLFW (int width, int height)
+/* Whole board as a few static meshes - switching layouts only picks another set of chunks */
+void createLandBaked()
 {
-    GLFWwindow* window; // window desciptor/handle
+	vector<LevelChunk>& chunks = levelChunks[randVal];
+	for(size_t c=0; c<chunks.size(); c++)
+		if(getMesh(chunks[c].mesh)->NumIndices>0 && isVisible(chunks[c].bounds, glm::vec3(0)))
+			drawModel(chunks[c].mesh, glm::mat4(1.0f));
+}
 
-    glfwSetErrorCallback(error_callback);
-    if (!glfwInit()) {
-        exit(EXIT_FAILURE);
-    }
+//------------------------------------LEVEL CACHE--------------------------------------------------------
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+/* The baked chunks of every layout are kept in a binary file, vertices and indices exactly as the
+   GPU takes them. On the next start the file is mmap()ed and its buffers handed to glBufferData
+   without any parsing; a header that does not match the current board, format or bake code
+   (LEVEL_CACHE_VERSION) makes the game bake again and rewrite the file. */
+#define LEVEL_CACHE_MAGIC 0x4c564c42		// "BLVL"
+#define LEVEL_CACHE_VERSION 1				// bump whenever baking or the level vertex layout changes
 
-    window = glfwCreateWindow(width, height, "Sample OpenGL 3.3 Application", NULL, NULL);
+const char* levelCacheFile = "level.cache";		// NULL: always bake
 
-    if (!window) {
-        glfwTerminate();
-        exit(EXIT_FAILURE);
-    }
+struct LevelCacheHeader {
+	GLuint magic, version;
+	GLint boardMinX, boardMaxX, boardMinZ, boardMaxZ, modVal, chunkSize;
+	GLint vertexFormat;
+	GLint layouts, chunks;
+	GLuint fileSize;
+};
 
-    glfwMakeContextCurrent(window);
-    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-    glfwSwapInterval( 1 );
-    glfwSetFramebufferSizeCallback(window, reshapeWindow);
-    glfwSetWindowSizeCallback(window, reshapeWindow);
-    glfwSetWindowCloseCallback(window, quit);
-    glfwSetKeyCallback(window, keyboard);      // general keyboard input
-    glfwSetCharCallback(window, keyboardChar);  // simpler specific character handling
-    glfwSetMouseButtonCallback(window, mouseButton);  // mouse button clicks
-    glfwSetCursorPosCallback(window, checkMouseCoordinates);
-    return window;
+struct LevelCacheChunk {
+	GLint layout, minX, maxX, minZ, maxZ;
+	GLint numVertices, numIndices;
+	GLuint indexType;
+	GLuint vertexOffset, indexOffset;		// from the start of the file
+	GLfloat bounds[6];						// min xyz, max xyz
+};
+
+LevelCacheHeader levelCacheHeader ()
+{
+	LevelCacheHeader header = { LEVEL_CACHE_MAGIC, LEVEL_CACHE_VERSION, boardMinX, boardMaxX, boardMinZ, boardMaxZ, modVal, CHUNK_SIZE, VERTEX_FLOAT, LAYOUT_COUNT, 0, 0 };
+	return header;
 }
 
-void initGL (GLFWwindow* window, int width, int height)
+/* Create the level chunks of every layout from the cache file; returns its size, 0 if unusable */
+int loadLevelCache ()
 {
-	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
-	reshapeWindow (window, width, height);
-	glClearDepth (1.0f);
-	glEnable (GL_DEPTH_TEST);
-	glDepthFunc (GL_LEQUAL);
+	if(levelCacheFile==NULL)
+		return 0;
+	int fd = open(levelCacheFile, O_RDONLY);
+	if(fd<0)
+		return 0;
+	struct stat info;
+	if(fstat(fd, &info)<0 || info.st_size<(off_t)sizeof(LevelCacheHeader))
+	{
+		close(fd);
+		return 0;
+	}
+	size_t size = info.st_size;
+	void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map==MAP_FAILED)
+		return 0;
+
+	const char* file = (const char*)map;
+	const LevelCacheHeader* header = (const LevelCacheHeader*)file;
+	LevelCacheHeader expected = levelCacheHeader();
+	expected.chunks = header->chunks;
+	expected.fileSize = size;
+	int valid = memcmp(header, &expected, sizeof(expected))==0 && header->chunks>=0
+		&& sizeof(LevelCacheHeader)+(size_t)header->chunks*sizeof(LevelCacheChunk)<=size;
+
+	// everything a stale or damaged file could hand to glDrawElements is checked before any of it is used
+	const LevelCacheChunk* records = (const LevelCacheChunk*)(file+sizeof(LevelCacheHeader));
+	for(int c=0; valid && c<header->chunks; c++)
+	{
+		const LevelCacheChunk& r = records[c];
+		valid = r.layout>=0 && r.layout<LAYOUT_COUNT && r.numVertices>=0 && r.numIndices>=0
+			&& (r.indexType==GL_UNSIGNED_SHORT || r.indexType==GL_UNSIGNED_INT)
+			&& (size_t)r.vertexOffset+(size_t)r.numVertices*vertexStride(VERTEX_FLOAT)<=size
+			&& (size_t)r.indexOffset+(size_t)r.numIndices*(r.indexType==GL_UNSIGNED_INT ? 4 : 2)<=size;
+		for(int k=0; valid && k<r.numIndices; k++)
+		{
+			GLuint index;
+			if(r.indexType==GL_UNSIGNED_INT)
+				memcpy(&index, file+r.indexOffset+4*(size_t)k, 4);
+			else
+			{
+				GLushort shortIndex;
+				memcpy(&shortIndex, file+r.indexOffset+2*(size_t)k, 2);
+				index = shortIndex;
+			}
+			valid = index<(GLuint)r.numVertices;
+		}
+	}
+	if(!valid)
+	{
+		printf("Ignoring %s: it does not match this board or is damaged - baking the levels again\n", levelCacheFile);
+		munmap(map, size);
+		return 0;
+	}
 
+	for(int c=0; c<header->chunks; c++)
+	{
+		const LevelCacheChunk& r = records[c];
+		VAO* mesh = createPackedObject(GL_TRIANGLES, VERTEX_FLOAT, r.numVertices, file+r.vertexOffset);
+		setIndexData(mesh, file+r.indexOffset, r.numIndices, r.indexType);
+
+		LevelChunk chunk;
+		chunk.mesh = registerMesh(mesh);
+		chunk.minX = r.minX;
+		chunk.maxX = r.maxX;
+		chunk.minZ = r.minZ;
+		chunk.maxZ = r.maxZ;
+		chunk.bounds.min = glm::vec3(r.bounds[0], r.bounds[1], r.bounds[2]);
+		chunk.bounds.max = glm::vec3(r.bounds[3], r.bounds[4], r.bounds[5]);
+		levelChunks[r.layout].push_back(chunk);
+	}
+	munmap(map, size);
+	return size;
 }
- 
-VAO* Rectangles1()
+
+/* Write the level chunks of every layout, reading their buffers back from the GPU */
+void writeLevelCache ()
 {
-    static const GLfloat buf [] = {
-    0,0,0,     1,0,0,     0,-2,0,
-    1,0,0,     1,-2,0,    0,-2,0, 
-    };
-    static const GLfloat col [] = {
-    1,0,0,     1,0,0,     1,0,0, 
-    1,0,0,     1,0,0,     1,0,0,     };
+	if(levelCacheFile==NULL)
+		return;
+
+	vector<LevelCacheChunk> records;
+	vector<char> data;
+	for(int layout=0; layout<LAYOUT_COUNT; layout++)
+		for(size_t c=0; c<levelChunks[layout].size(); c++)
+		{
+			const LevelChunk& chunk = levelChunks[layout][c];
+			VAO* mesh = getMesh(chunk.mesh);
+			LevelCacheChunk r = { layout, chunk.minX, chunk.maxX, chunk.minZ, chunk.maxZ, mesh->NumVertices, mesh->NumIndices, mesh->IndexType, 0, 0,
+				{ chunk.bounds.min.x, chunk.bounds.min.y, chunk.bounds.min.z, chunk.bounds.max.x, chunk.bounds.max.y, chunk.bounds.max.z } };
+			int vertexBytes = mesh->NumVertices*vertexStride(mesh->Format), indexBytes = meshBytes(mesh)-vertexBytes;
+
+			r.vertexOffset = data.size();
+			data.resize(data.size()+vertexBytes);
+			glBindBuffer(GL_COPY_READ_BUFFER, mesh->VertexBuffer);
+			if(vertexBytes>0)
+				glGetBufferSubData(GL_COPY_READ_BUFFER, 0, vertexBytes, &data[r.vertexOffset]);
+			r.indexOffset = data.size();
+			data.resize(data.size()+indexBytes);
+			glBindBuffer(GL_COPY_READ_BUFFER, mesh->IndexBuffer);
+			if(indexBytes>0)
+				glGetBufferSubData(GL_COPY_READ_BUFFER, 0, indexBytes, &data[r.indexOffset]);
+			records.push_back(r);
+		}
 
-    VAO* rectangles = create3DObject(GL_TRIANGLES, 6, buf, col, GL_FILL);
-    return rectangles;
+	LevelCacheHeader header = levelCacheHeader();
+	GLuint dataStart = sizeof(LevelCacheHeader)+records.size()*sizeof(LevelCacheChunk);
+	header.chunks = records.size();
+	header.fileSize = dataStart+data.size();
+	for(size_t c=0; c<records.size(); c++)
+	{
+		records[c].vertexOffset += dataStart;
+		records[c].indexOffset += dataStart;
+	}
 
+	// written next to the cache and renamed, so a crash never leaves a torn file behind
+	string temporary = string(levelCacheFile)+".tmp";
+	FILE* out = fopen(temporary.c_str(), "wb");
+	if(out==NULL)
+	{
+		printf("Cannot write %s\n", temporary.c_str());
+		return;
+	}
+	int ok = fwrite(&header, sizeof(header), 1, out)==1
+		&& fwrite(&records[0], sizeof(LevelCacheChunk), records.size(), out)==records.size()
+		&& (data.empty() || fwrite(&data[0], data.size(), 1, out)==1);
+	ok = (fclose(out)==0) && ok;
+	if(!ok || rename(temporary.c_str(), levelCacheFile)!=0)
+	{
+		printf("Cannot write %s\n", levelCacheFile);
+		unlink(temporary.c_str());
+	}
 }
-VAO* Rectangles2()
-{
-	static const GLfloat buf [] = {
-    0,0,0,     1,0,0,     0,-2,0,    1,0,0,
-    1,-2,0,
-    0,-2,0, 
-    };
-	static const GLfloat col2 [] = {
-    0,0,1,     0,0,1,    0,0,1,
-    0,0,1,     0,0,1,     0,0,1,     };
 
-    VAO* rectangles = create3DObject(GL_TRIANGLES, 6, buf, col2, GL_FILL);
-    return rectangles;
 
-}
+//------------------------------------BOARD MESHER--------------------------------------------------------
 
-VAO* Triangles(int up)
-{
-	static const GLfloat vertex_buffer_data [] = {
-    0, 0, 0,    0, 1, 0,    1, 0, 0,
-    0, 1, 0,    1, 0, 0,    1, 1, 0
-  };
+/* Only faces that can be seen are kept: a side shared with a neighbouring tile is dropped, and
+   runs of exposed sides as well as rectangles of tops in the same state are merged into single
+   quads, so the vertex count follows the perimeter of the board and its holes rather than its
+   area. Board_GL.frag rebuilds the per tile gradient of the merged tops. */
+int boardMeshTiles = 0, boardMeshVertices = 0;		// over all layouts, for the start up report
 
-  static const GLfloat color_buffer_data [] = {
-    1,0,0,     1,1,1,     1,1,1, 
-    1,1,1,     1,1,1,     1,0,0,
-    };
-   static const GLfloat color_buffer_data2 [] = {
-    0.35,0.45,0.41,     1,1,1,     1,1,1, 
-    1,1,1,     1,1,1,    0.35,0.45,0.41   };
-      if(up==0)
-  	return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL); 
-  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data2, GL_FILL); 
+/* -1 for a hole or outside the board, 1 for a tile carrying an obstacle, 0 otherwise */
+int boardCell (int i, int j, int layout)
+{
+	if(i<boardMinX || i>=boardMaxX || j<boardMinZ || j>=boardMaxZ)
+		return -1;
+	if(i+j==layout && layout!=0)
+		return -1;
+	return (2*i+3*j + layout)% modVal == 0;
+}
 
+/* Append the quad a b c d (corners in order around it) in one flat color */
+void appendQuad (Geometry& g, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d, const GLfloat* color)
+{
+	GLuint base = g.pos.size()/3;
+	glm::vec3 corners[4] = { a, b, c, d };
+	for(int v=0; v<4; v++)
+		for(int k=0; k<3; k++)
+		{
+			g.pos.push_back(corners[v][k]);
+			g.col.push_back(color[k]);
+		}
+	GLuint quad[6] = { 0, 1, 2, 0, 2, 3 };
+	for(int k=0; k<6; k++)
+		g.indices.push_back(base+quad[k]);
+}
 
+/* Merge the exposed front (dz=1) or back (dz=-1) faces of row j into runs along x */
+void meshRowSides (Geometry& g, int layout, int j, int dz, const GLfloat* color)
+{
+	float z = dz>0 ? j : j-1;
+	for(int i=boardMinX; i<boardMaxX; )
+	{
+		if(boardCell(i, j, layout)<0 || boardCell(i, j+dz, layout)>=0)
+		{
+			i++;
+			continue;
+		}
+		int end=i+1;
+		while(end<boardMaxX && boardCell(end, j, layout)>=0 && boardCell(end, j+dz, layout)<0)
+			end++;
+		appendQuad(g, glm::vec3(i,0,z), glm::vec3(end,0,z), glm::vec3(end,-2,z), glm::vec3(i,-2,z), color);
+		i=end;
+	}
 }
-VAO* obstacle()
+
+/* Merge the exposed left (dx=-1) or right (dx=1) faces of column i into runs along z */
+void meshColumnSides (Geometry& g, int layout, int i, int dx, const GLfloat* color)
 {
-	static const GLfloat vertex_buffer_data [] = {
-    0, 0, 0,    0.5, 1.5, 0,    1, 0, 0, };
+	float x = dx>0 ? i+1 : i;
+	for(int j=boardMinZ; j<boardMaxZ; )
+	{
+		if(boardCell(i, j, layout)<0 || boardCell(i+dx, j, layout)>=0)
+		{
+			j++;
+			continue;
+		}
+		int end=j+1;
+		while(end<boardMaxZ && boardCell(i, end, layout)>=0 && boardCell(i+dx, end, layout)<0)
+			end++;
+		appendQuad(g, glm::vec3(x,0,j-1), glm::vec3(x,0,end-1), glm::vec3(x,-2,end-1), glm::vec3(x,-2,j-1), color);
+		j=end;
+	}
+}
 
-    static const GLfloat color_buffer_data [] = {
-    0.2,0.91,1.0,    0.6,0.23,0.56,     0.2,0.91,1.0 };
+/* Mesh the visible faces of layout into its board mesh; returns the GPU bytes used */
+int meshBoard(int layout)
+{
+	int width = boardMaxX-boardMinX, depth = boardMaxZ-boardMinZ, tiles = 0;
+	vector<char> merged(width*depth, 0);
+	Geometry board;
 
-    return create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_FILL);
+	// tops - grow a rectangle along x, then along z while whole rows still match
+	for(int j=boardMinZ; j<boardMaxZ; j++)
+		for(int i=boardMinX; i<boardMaxX; i++)
+		{
+			int state = boardCell(i, j, layout);
+			if(state<0 || merged[(j-boardMinZ)*width + i-boardMinX])
+				continue;
+			int endX=i+1, endZ=j+1;
+			while(endX<boardMaxX && boardCell(endX, j, layout)==state && !merged[(j-boardMinZ)*width + endX-boardMinX])
+				endX++;
+			for(int rowFits=ON; endZ<boardMaxZ && rowFits; )
+			{
+				for(int x=i; x<endX && rowFits; x++)
+					rowFits = boardCell(x, endZ, layout)==state && !merged[(endZ-boardMinZ)*width + x-boardMinX];
+				if(rowFits)
+					endZ++;
+			}
+			for(int z=j; z<endZ; z++)
+				for(int x=i; x<endX; x++)
+					merged[(z-boardMinZ)*width + x-boardMinX] = 1;
+			tiles += (endX-i)*(endZ-j);
+			appendQuad(board, glm::vec3(i,0,j-1), glm::vec3(endX,0,j-1), glm::vec3(endX,0,endZ-1), glm::vec3(i,0,endZ-1), state ? tileTopObstacleColors : tileTopColors);
+		}
 
+	for(int j=boardMinZ; j<boardMaxZ; j++)
+	{
+		meshRowSides(board, layout, j, 1, tileFrontColors);
+		meshRowSides(board, layout, j, -1, tileFrontColors);
+	}
+	for(int i=boardMinX; i<boardMaxX; i++)
+	{
+		meshColumnSides(board, layout, i, -1, tileSideColors);
+		meshColumnSides(board, layout, i, 1, tileSideColors);
+	}
 
+	VAO* mesh = create3DObject(GL_TRIANGLES, board.pos.size()/3, board.pos.empty() ? NULL : &board.pos[0], board.col.empty() ? NULL : &board.col[0]);
+	setIndices(mesh, board.indices);
+	Meshes.board[layout] = registerMesh(mesh);
+	boardMeshTiles += tiles;
+	boardMeshVertices += board.pos.size()/3;
+	return meshBytes(mesh);
 }
-void drawObstacle(int i, int up, int j)
+
+/* Board as one mesh of its visible faces, obstacles instanced on top */
+void createLandMeshed()
 {
-	VAO* O = obstacle();
-
-	Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::translate(glm::vec3(i, up, j))*glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-   	draw3DObject(O);
-
-  	//LEFT side
-  	Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::translate(glm::vec3(i, up, j))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0))*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(O);
-
-	//RIGHT side
-	Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::translate(glm::vec3(1+i,up,j))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0))*glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(O);
-
-	//BACK side
-    Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::translate(glm::vec3(i,up,-1+j))*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(O);
-
-	//------------LOWER HALF--------------------------------------------
-
-	j*=-1;
-	up*=-1;
-	Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::rotate(DEG2RAD(180), glm::vec3(1,0,0))*glm::translate(glm::vec3(i, up, j+1))*glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-   	draw3DObject(O);
-
-  	//LEFT side
-  	Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::rotate(DEG2RAD(180), glm::vec3(1,0,0))*glm::translate(glm::vec3(i, up, j+1))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0))*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(O);
-
-	//RIGHT side
-	Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::rotate(DEG2RAD(180), glm::vec3(1,0,0))*glm::translate(glm::vec3(1+i,up,j+1))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0))*glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(O);
-
-	//BACK side
-    Matrices.model = glm::mat4(1.0f);
-	Matrices.model*=glm::rotate(DEG2RAD(180), glm::vec3(1,0,0))*glm::translate(glm::vec3(i,up,-1+j+1))*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0));
-	MVP=VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(O);
+	drawWorldSpace(Meshes.board[randVal], boardProgramID);
+	updateLandInstances(OFF);
+	if(getMesh(Meshes.obstacleInstanced)->NumInstances>0)
+		drawInstanced(Meshes.obstacleInstanced);
+}
+
+//------------------------------------VERTEX PULLED BOARD--------------------------------------------------------
+
+/* The whole board, obstacles included, is one instanced draw without vertex buffers. Pulled_GL.vert
+   takes the prism and spike corners from uniform arrays filled once from the compile time tables
+   and applies the obstacle and hole rules itself, so a new layout only costs setting RandVal.
+   It also knows the layout before, so it animates layout changes like the instanced board. */
+int pulledLayoutChanges = -1;	// layoutChanges the pulled board program was told about
+float pulledLayoutTime = -1;	// LayoutTime it was given
+GLint pulledLayoutTimeID;
 
+void initPulledBoard ()
+{
+	GLfloat corners[3*54], colors[3*54];
+	memcpy(corners, tileMesh.pos, sizeof(tileMesh.pos));
+	memcpy(corners+3*30, spikeMesh.pos, sizeof(spikeMesh.pos));
+	memcpy(colors, tileMesh.col, sizeof(tileMesh.col));
+	memcpy(colors+3*30, spikeMesh.col, sizeof(spikeMesh.col));
+
+	useProgram(pulledProgramID);
+	glUniform3fv(glGetUniformLocation(pulledProgramID, "Corners"), 54, corners);
+	glUniform3fv(glGetUniformLocation(pulledProgramID, "Colors"), 54, colors);
+	glUniform3fv(glGetUniformLocation(pulledProgramID, "ObstacleTopColors"), 6, tileObstacleMesh.col+3*24);
+	glUniform2i(glGetUniformLocation(pulledProgramID, "BoardMin"), boardMinX, boardMinZ);
+	glUniform1i(glGetUniformLocation(pulledProgramID, "BoardWidth"), boardMaxX-boardMinX);
+	glUniform1i(glGetUniformLocation(pulledProgramID, "BoardDepth"), boardMaxZ-boardMinZ);
+	glUniform1i(glGetUniformLocation(pulledProgramID, "ModVal"), modVal);
+	glUniform1f(glGetUniformLocation(pulledProgramID, "TransitionLength"), max(transitionSeconds, 0.001f));
+	pulledLayoutTimeID = glGetUniformLocation(pulledProgramID, "LayoutTime");
+
+	Meshes.pulledBoard = registerMesh(createPulledObject(GL_TRIANGLES, 54, (boardMaxX-boardMinX)*(boardMaxZ-boardMinZ)));
 }
 
-void drawAxis()
+void createLandPulled()
 {
-	static const GLfloat X [] = {
-		10, 0, 0,		-10, 0, 0,
-	};
-	static const GLfloat Y [] = {
-		0, 10, 0,		0, -10, 0
-	};
-	static const GLfloat Z [] = {
-		0, 0, 10,		0, 0, -10
-	};
-	static const GLfloat colX [] = {
-		1, 1, 1,		1, 1, 1
-	};
-	static const GLfloat colY [] = {
-		0, 1, 0,		0, 1, 0
-	};
-	static const GLfloat colZ [] = {
-		1, 0, 0,		1, 0, 0
-	};
-	VAO* line1= create3DObject(GL_LINE_STRIP,2, X, colX, GL_FILL);
-	VAO* line2= create3DObject(GL_LINE_STRIP,2, Y, colY, GL_FILL);
-	VAO* line3= create3DObject(GL_LINE_STRIP,2, Z, colZ, GL_FILL);
-	Matrices.model=glm::mat4(1.0f);
-	MVP= VP*Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(line1);
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(line2);
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(line3);
+	if(pulledLayoutChanges!=layoutChanges)
+	{
+		useProgram(pulledProgramID);
+		glUniform1i(glGetUniformLocation(pulledProgramID, "RandVal"), shownLayout);
+		glUniform1i(glGetUniformLocation(pulledProgramID, "OldRandVal"), previousLayout);
+		pulledLayoutChanges=layoutChanges;
+	}
+	if(pulledLayoutTime!=layoutTime)
+	{
+		useProgram(pulledProgramID);
+		glUniform1f(pulledLayoutTimeID, layoutTime);
+		frameStats.uniformUpdates++;
+		pulledLayoutTime=layoutTime;
+	}
+	drawWorldSpace(Meshes.pulledBoard, pulledProgramID);
 }
+
+//----------------------------------------------------------------------------------------------------------
+
 void createLand()
 {
-    int up=0;
-	VAO* T= Triangles(0);	
-	VAO* T2	= Triangles(1);
-	VAO* R1= Rectangles1();
-	VAO* R2=Rectangles2();
-	VAO* oldT=T;
-
-	for(int i=-5; i<5; i++)				//-5 to 5
-    {
-    	for(int j=-4; j<6; j++)				//-4 to 6
-    	{
-    		if((2*i+3*j + randVal)% modVal == 0)
-    		{
-    			up=0;
-    			drawObstacle(i, 1, j);
-    			oldT=T;
-    			T=T2;
-    		}
-    		else
-    		{
-    			T=oldT;
-    			up=0;
-    		}
-    		if(player.x==i && player.z==j)
-    			up=0;
-    		if(i+j==randVal && randVal!=0)
-    			continue;
+	if(shownLayout!=randVal)
+	{
+		previousLayout = shownLayout<0 || transitionSeconds<=0 ? randVal : shownLayout;
+		shownLayout=randVal;
+		layoutChanges++;
+		layoutChangeTime=glfwGetTime();
+		layoutTransition=ON;
+	}
+	if(layoutTransition==ON)
+	{
+		// the wave takes twice as long as a tile; past its end every tile shows the new layout
+		layoutTime = glfwGetTime()-layoutChangeTime;
+		if(layoutTime>=2*transitionSeconds)
+		{
+			layoutTime = 2*transitionSeconds+1;
+			layoutTransition=OFF;
+			previousLayout=shownLayout;		// the boards drop what sank away
+			layoutChanges++;
+		}
+		else
+			frameDirty=ON;			// keep drawing in on-demand mode until it settles
+	}
 
-    		//-----------------------------------------------------------------------------------------
-    		Matrices.model = glm::mat4(1.0f);
-    		Matrices.model*=glm::translate(glm::vec3(i, up, j));
-    		MVP=VP*Matrices.model;
-        	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-       		draw3DObject(R1);
-
-  			//LEFT side
-  		  	Matrices.model = glm::mat4(1.0f);
-        	Matrices.model*=glm::translate(glm::vec3(i, up, j))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0));
-        	MVP=VP*Matrices.model;
-        	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        	draw3DObject(R2);
-
-    		//RIGHT side
-    		Matrices.model = glm::mat4(1.0f);
-        	Matrices.model*=glm::translate(glm::vec3(1+i,up,j))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0));
-        	MVP=VP*Matrices.model;
-        	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        	draw3DObject(R2);
-
-    		//BACK side
-    		Matrices.model = glm::mat4(1.0f);
-        	Matrices.model*=glm::translate(glm::vec3(i,up,-1+j));
-        	MVP=VP*Matrices.model;
-        	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        	draw3DObject(R1);
-    		//-----------------------------------------------------------------------------------------
-		  	
-		  	Matrices.model = glm::mat4(1.0f);
-		  	Matrices.model*=glm::translate(glm::vec3(i, up, j))*glm::rotate(DEG2RAD(-90), glm::vec3(1, 0,0));
-		  	MVP=VP*Matrices.model;
-		  	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		 	draw3DObject(T);
-    	}
-    }
+	if(landMode==LAND_INSTANCED)
+		createLandInstanced();
+	else if(landMode==LAND_MESHED)
+		createLandMeshed();
+	else if(landMode==LAND_PULLED)
+		createLandPulled();
+	else if(landMode==LAND_BAKED)
+		createLandBaked();
+	else
+		createLandLegacy();
 
     if(keyboardCount>6)			//after 2 consecutive press and releases
 	{	randVal= rand() % 10;	keyboardCount=0; }
        
 }
-void movePlayer()
+/* The player cube relative to the player position */
+void buildPlayerGeometry (Geometry& cube)
 {
- VAO *rectangle1, *rectangle2, *triangle;
-
-    static const GLfloat buf [] = {
-    0,0,0,     1,0,0,     0,1,0,     1,0,0,
-    1,1,0,    0,1,0,     };
+	tableGeometry(cube, playerMesh);
+}
 
-    static const GLfloat col [] = {
-    0,0.39,0,     0,0.39,0,    0,0.39, 0,
-    0,0.39,0,    0,0.39,0,     0,0.39, 0,    };
+/* Largest difference between table t and numVertices vertices placed at runtime by glm */
+template<int N>
+float tableError (const MeshTable<N>& t, const vector<GLfloat>& pos, const vector<GLfloat>& col)
+{
+	float error = (int)pos.size()==3*N ? 0 : 1e9f;
+	for(int k=0; k<3*N && k<(int)pos.size(); k++)
+		error = max(error, max(fabsf(t.pos[k]-pos[k]), fabsf(t.col[k]-col[k])));
+	return error;
+}
 
-    static const GLfloat col2 [] = {
-    0,1,0,     0,1,0,     0,1,0, 
-    0,1,0,     0,1,0,     0,1,0,     };
+/* --verify-tables: place every face with glm rotations, the way the meshes used to be built,
+   and compare against the compile time tables. Returns the number of tables that differ. */
+int verifyTables ()
+{
+	glm::mat4 rotY90 = glm::rotate(DEG2RAD(90), glm::vec3(0,1,0));
+	glm::mat4 top = glm::rotate(DEG2RAD(-90), glm::vec3(1,0,0));
+	glm::mat4 sides[4] = {
+		glm::mat4(1.0f),
+		rotY90,
+		glm::translate(glm::vec3(1,0,0))*rotY90,
+		glm::translate(glm::vec3(0,0,-1))
+	};
+	const GLfloat* tileColors[4] = { tileFrontColors, tileSideColors, tileSideColors, tileFrontColors };
+	const GLfloat* playerColors[4] = { playerFrontColors, playerSideColors, playerSideColors, playerFrontColors };
+	vector<GLfloat> tilePos, tileCol, obstaclePos, obstacleCol, spikePos, spikeCol, playerPos, playerCol;
 
-    static const GLfloat vertex_buffer_data [] = {
-    0, 0, 0,    0, 1, 0,    1, 0, 0,
-    0, 1, 0,    1, 0, 0,    1, 1, 0
+	for(int f=0; f<4; f++)
+	{
+		appendTransformed(tilePos, tileCol, 6, tileSideVertices, tileColors[f], sides[f]);
+		appendTransformed(playerPos, playerCol, 6, playerSideVertices, playerColors[f], sides[f]);
+	}
+	obstaclePos=tilePos;
+	obstacleCol=tileCol;
+	appendTransformed(tilePos, tileCol, 6, tileTopVertices, tileTopColors, top);
+	appendTransformed(obstaclePos, obstacleCol, 6, tileTopVertices, tileTopObstacleColors, top);
+	appendTransformed(playerPos, playerCol, 6, tileTopVertices, playerTopColors, glm::translate(glm::vec3(0,1,0))*top);
+
+	glm::mat4 flip = glm::rotate(DEG2RAD(180), glm::vec3(1,0,0));
+	glm::mat4 spikes[8] = {
+		glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0)),
+		rotY90*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0)),
+		glm::translate(glm::vec3(1,0,0))*rotY90*glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0)),
+		glm::translate(glm::vec3(0,0,-1))*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0)),
+		flip*glm::translate(glm::vec3(0,0,1))*glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0)),
+		flip*glm::translate(glm::vec3(0,0,1))*rotY90*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0)),
+		flip*glm::translate(glm::vec3(1,0,1))*rotY90*glm::rotate(DEG2RAD(-45), glm::vec3(1,0,0)),
+		flip*glm::rotate(DEG2RAD(45), glm::vec3(1,0,0))
 	};
+	for(int f=0; f<8; f++)
+		appendTransformed(spikePos, spikeCol, 3, spikeVertices, spikeColors, spikes[f]);
+
+	const char* names[4] = { "tile", "tile with obstacle", "spikes", "player" };
+	float errors[4] = {
+		tableError(tileMesh, tilePos, tileCol),
+		tableError(tileObstacleMesh, obstaclePos, obstacleCol),
+		tableError(spikeMesh, spikePos, spikeCol),
+		tableError(playerMesh, playerPos, playerCol)
+	};
+	int failed = 0;
+	for(int t=0; t<4; t++)
+	{
+		int ok = errors[t]<1e-5f;
+		printf("%-20s max difference %g %s\n", names[t], errors[t], ok ? "ok" : "MISMATCH");
+		failed += !ok;
+	}
+	return failed;
+}
 
-  static const GLfloat color_buffer_data [] = {
-    0,1,0,     0,0,0,     0,1,0, 
-    0,0,0,     0,1,0,     0,1,0, 	};
+/* Bake and mesh every layout randVal can take, so a layout change in createLand() only selects
+   other meshes */
+void precomputeLayouts()
+{
+	double start = glfwGetTime();
+	int bakedBytes = 0, meshedBytes = 0, cachedBytes = loadLevelCache();
+	double baked = glfwGetTime();
+	for(int layout=0; layout<LAYOUT_COUNT; layout++)
+	{
+		if(cachedBytes==0)
+			bakedBytes += bakeLevel(layout);
+		else
+			for(size_t c=0; c<levelChunks[layout].size(); c++)
+				bakedBytes += meshBytes(getMesh(levelChunks[layout][c].mesh));
+		meshedBytes += meshBoard(layout);
+	}
+	if(cachedBytes>0)
+		printf("Loaded the baked levels of %d layouts from %s (%d KB) in %.2f ms\n", LAYOUT_COUNT, levelCacheFile, cachedBytes/1024, (baked-start)*1000.0);
+	else
+		writeLevelCache();
+	printf("Precomputed %d layouts in %.2f ms: baked levels %d KB, meshed boards %d KB (%d tiles in %d vertices)\n", LAYOUT_COUNT,
+		(glfwGetTime()-start)*1000.0, bakedBytes/1024, meshedBytes/1024, boardMeshTiles, boardMeshVertices);
+}
 
-	triangle=create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-    rectangle1 = create3DObject(GL_TRIANGLES, 6, buf, col, GL_FILL);
-    rectangle2= create3DObject(GL_TRIANGLES, 6, buf, col2, GL_FILL);
-    //FRONT side
+/* Build every mesh once - draw() only ever looks them up */
+void createMeshes()
+{
+	buildTileGeometry(tileGeometry);
+	buildObstacleGeometry(obstacleGeometry);
+	buildPlayerGeometry(playerGeometry);
+
+	Meshes.tile = registerMesh(indexedObject(tileGeometry, tileGeometry.col));
+	Meshes.tileObstacle = registerMesh(indexedObject(tileGeometry, tileGeometry.altCol));
+	Meshes.obstacle = registerMesh(obstacle());
+	Meshes.obstacleInstanced = registerMesh(obstacle());
+	Meshes.player = registerMesh(indexedObject(playerGeometry, playerGeometry.col));
+	Meshes.axisX = registerMesh(Axis(0));
+	Meshes.axisY = registerMesh(Axis(1));
+	Meshes.axisZ = registerMesh(Axis(2));
+	Meshes.tileInstanced = registerMesh(TileInstanceMesh());
+	initInstancedBoard();
+	initPulledBoard();
+	tileBounds = geometryBounds(tileGeometry);
+	obstacleBounds = geometryBounds(obstacleGeometry);
+	precomputeLayouts();
+}
+void movePlayer()
+{
+    //whole cube in one draw
     Matrices.model = glm::mat4(1.0f);
     	Matrices.model*=glm::translate(glm::vec3(player.x, player.y, player.z));
-    	MVP=VP*Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(rectangle1);
-
-    //LEFT side
-    Matrices.model = glm::mat4(1.0f);
-        Matrices.model*=glm::translate(glm::vec3(player.x, player.y, player.z))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0));
-        MVP=VP*Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(rectangle2);
-
-    //RIGHT side
-    Matrices.model = glm::mat4(1.0f);
-        Matrices.model*=glm::translate(glm::vec3(player.x+1, player.y, player.z))*glm::rotate(DEG2RAD(90), glm::vec3(0,1,0));
-        MVP=VP*Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(rectangle2);
-
-    //BACK side
-    Matrices.model = glm::mat4(1.0f);
-        Matrices.model*=glm::translate(glm::vec3(player.x, player.y, player.z-1));
-        MVP=VP*Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(rectangle1);
-
-    //Top
-    Matrices.model = glm::mat4(1.0f);
-    	Matrices.model*=Matrices.model*glm::translate(glm::vec3(player.x, player.y+1, player.z))*glm::rotate(DEG2RAD(-90), glm::vec3(1, 0,0));
-		MVP=VP*Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(triangle);
+    	drawModel(Meshes.player, Matrices.model);
 
 }
+const char* viewName()
+{
+	if(splitScreen==ON)
+		return "split";
+	if(towerView==ON)
+		return "tower";
+	if(topView==ON)
+		return "top";
+	if(adventureView==ON)
+		return "adventure";
+	if(followcamView==ON)
+		return "follow";
+	if(helicopterView==ON)
+		return "helicopter";
+	return "free";
+}
+
 void getLookAtAttributes()
 {
 	if(towerView == ON)
@@ -996,10 +3537,48 @@ void getLookAtAttributes()
 
 	}
 }
+/* VP of the camera selected by the view flags */
+glm::mat4 cameraViewProjection()
+{
+	getLookAtAttributes();
+
+	glm::vec3 eye(eyePos.x, eyePos.y, eyePos.z);
+	glm::vec3 target(targetPos.x, targetPos.y, targetPos.z);
+	glm::vec3 up (upPos.x, upPos.y, upPos.z);
+	Matrices.view = glm::lookAt(eye, target, up);
+	return Matrices.projection*Matrices.view;
+}
+
+/* VPs of the tower, top, adventure and follow cameras for the split screen. The selected view and
+   the camera it left behind (the helicopter view keeps moving it) are restored afterwards. */
+void setSplitViews()
+{
+	int* flags[] = { &towerView, &topView, &adventureView, &followcamView, &helicopterView };
+	int saved[5];
+	Point savedEye=eyePos, savedTarget=targetPos, savedUp=upPos;
+	float savedAngle=camAngle;
+	for(int f=0; f<5; f++)
+		saved[f]=*flags[f];
+
+	numViews=MAX_VIEWS;
+	for(int v=0; v<numViews; v++)
+	{
+		for(int f=0; f<5; f++)
+			*flags[f] = (f==v) ? ON : OFF;
+		viewVPs[v]=cameraViewProjection();
+	}
+
+	for(int f=0; f<5; f++)
+		*flags[f]=saved[f];
+	eyePos=savedEye; targetPos=savedTarget; upPos=savedUp;
+	camAngle=savedAngle;
+}
+
 void  checkIfFalling()
 {
-	if(player.x+player.z==randVal || player.x>6 || player.x<-5 || player.z>5 || player.z<-4)
+	if((player.x+player.z==randVal && tileSinking(player.x, player.z)==OFF) || player.x>6 || player.x<-5 || player.z>5 || player.z<-4)
  	{
+     	emitParticles(glm::vec3(player.x+0.5f, player.y, player.z-0.5f), glm::vec3(0.0f, 1.0f, 0.0f));
      	fall=ON;
  		while(player.y>=-10)
  		{ player.y-=1; movePlayer(); usleep(1); }
@@ -1064,17 +3643,22 @@ void Jump()
 }
 void draw ()
 {
+	beginRenderCost();
+	beginGpuFrame();
+	beginScene();
 	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glUseProgram (programID);
+	useProgram (programID);
 
-	getLookAtAttributes();
-	
-	glm::vec3 eye(eyePos.x, eyePos.y, eyePos.z);
-	glm::vec3 target(targetPos.x, targetPos.y, targetPos.z);
-	glm::vec3 up (upPos.x, upPos.y, upPos.z);
-	Matrices.view = glm::lookAt(eye, target, up);
-
-	VP= Matrices.projection*Matrices.view;
+	if(splitScreen==ON)
+		setSplitViews();
+	else
+	{
+		numViews=1;
+		viewVPs[0]=cameraViewProjection();
+	}
+	VP=viewVPs[0];
+	for(int v=0; v<numViews; v++)
+		viewFrusta[v] = frustumFromVP(viewVPs[v]);
 	//drawAxis();
 	createLand();
  	movePlayer();
@@ -1086,6 +3670,15 @@ void draw ()
  	}
 
  	checkIfFalling();
+ 	updateParticles();
+ 	beginOverdraw();
+ 	flushRenderQueue();
+ 	endOverdraw();
+ 	endScene();
+ 	drawHud();
+ 	endGpuFrame();
+ 	endRenderCost();
+
  	if(player.x==4 && player.z==-4)
  	{
  		score+=50;
@@ -1104,6 +3697,69 @@ void draw ()
 int main (int argc, char** argv)
 {
 
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "--stats")==0)
+			showStats=ON;
+		else if(strcmp(argv[i], "--vertex-format=float")==0)
+			forcedVertexFormat=VERTEX_FLOAT;
+		else if(strcmp(argv[i], "--vertex-format=half")==0)
+			forcedVertexFormat=VERTEX_HALF;
+		else if(strcmp(argv[i], "--land=legacy")==0)
+			landMode=LAND_LEGACY;
+		else if(strcmp(argv[i], "--land=instanced")==0)
+			landMode=LAND_INSTANCED;
+		else if(strcmp(argv[i], "--land=baked")==0)
+			landMode=LAND_BAKED;
+		else if(strcmp(argv[i], "--land=meshed")==0)
+			landMode=LAND_MESHED;
+		else if(strcmp(argv[i], "--land=pulled")==0)
+			landMode=LAND_PULLED;
+		else if(strcmp(argv[i], "--transforms=uniform")==0)
+			useTransformBuffer=OFF;
+		else if(strcmp(argv[i], "--queue=unsorted")==0)
+			sortRenderQueue=OFF;
+		else if(strcmp(argv[i], "--verify-tables")==0)
+			return verifyTables()==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+		else if(strcmp(argv[i], "--bench-transforms")==0)
+		{
+			benchTransforms();
+			return 0;
+		}
+		else if(strcmp(argv[i], "--no-level-cache")==0)
+			levelCacheFile=NULL;
+		else if(strncmp(argv[i], "--level-cache=", 14)==0)
+			levelCacheFile=argv[i]+14;
+		else if(strcmp(argv[i], "--no-cull")==0)
+			frustumCulling=OFF;
+		else if(strncmp(argv[i], "--render-scale=", 15)==0)
+		{
+			renderScale=min(1.0f, max(0.1f, (float)atof(argv[i]+15)));
+			fixedRenderScale=ON;
+		}
+		else if(strncmp(argv[i], "--frame-budget=", 15)==0)
+			frameBudgetMs=atof(argv[i]+15);
+		else if(strncmp(argv[i], "--transition=", 13)==0)
+			transitionSeconds=max(0.0f, (float)atof(argv[i]+13));
+		else if(strcmp(argv[i], "--overdraw")==0)
+			overdrawView=ON;
+		else if(strcmp(argv[i], "--no-particles")==0)
+			particleEffects=OFF;
+		else if(strcmp(argv[i], "--no-hud")==0)
+			showHud=OFF;
+		else if(strcmp(argv[i], "--split-screen")==0)
+			splitScreen=ON;
+		else if(strcmp(argv[i], "--on-demand")==0)
+			onDemand=ON;
+		else if(strcmp(argv[i], "--gpu-times")==0)
+			gpuTimers=ON;
+		else if(strncmp(argv[i], "--gpu-times=", 12)==0)
+		{
+			gpuTimers=ON;
+			gpuTimesFile=argv[i]+12;
+		}
+	}
+
     GLFWwindow* window = initGLFW(windowWidth, windowHeight);
 
 	initGL (window, windowWidth, windowHeight);
@@ -1111,9 +3767,23 @@ int main (int argc, char** argv)
     double last_update_time = glfwGetTime(), current_time;
 
     while (!glfwWindowShouldClose(window)) {
-        draw();
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        int continuous = (onDemand==OFF && windowFocused==ON);
+        if (windowIconified==OFF && (continuous || frameDirty==ON)) {
+            int layout = randVal;
+            frameDirty = OFF;
+            beginFrameStats();
+            draw();
+            glfwSwapBuffers(window);
+            reportFrameStats();
+            if (randVal != layout)      // the new layout is only drawn next frame
+                frameDirty = ON;
+        }
+
+        continuous = (onDemand==OFF && windowFocused==ON);
+        if (windowIconified==OFF && (continuous || frameDirty==ON))
+            glfwPollEvents();
+        else
+            glfwWaitEventsTimeout(0.5);     // nothing to draw - sleep until input arrives
         current_time = glfwGetTime(); // Time in seconds
         if ((current_time - last_update_time) >= 0.5) { // atleast 0.5s elapsed since last frame
             last_update_time = current_time;
@@ -1122,6 +3792,5 @@ int main (int argc, char** argv)
         	quit(window);
     }
 
-    glfwTerminate();
-    exit(EXIT_SUCCESS);
+    quit(window);		// closing the window quits like 'Q' does
 }
\ No newline at end of file